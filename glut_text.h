@@ -0,0 +1,58 @@
+//
+//  glut_text.h
+//  paint
+//
+//  Funcoes auxiliares para desenhar texto na janela GLUT/OpenGL
+//
+
+#ifndef GLUT_TEXT_H
+#define GLUT_TEXT_H
+
+#ifdef __APPLE__
+    #define GL_SILENCE_DEPRECATION
+    #include <GLUT/glut.h>
+    #include <OpenGL/gl.h>
+#else
+    #include <GL/glut.h>
+    #include <GL/gl.h>
+#endif
+
+#include <string>
+
+// Cache de glifos: cada caractere ASCII imprimivel e compilado uma unica vez em
+// uma display list, que ja inclui o avanco horizontal do glifo. Um texto inteiro
+// e entao desenhado com uma so chamada a glCallLists
+static const int GLIFO_PRIMEIRO = 32;
+static const int GLIFO_QUANTIDADE = 95; // ' ' ate '~'
+static GLuint glifos_stroke = 0;
+
+// Funcao que compila as display lists dos glifos (exige um contexto OpenGL ativo)
+static inline void carregar_glifos_stroke(){
+    if (glifos_stroke != 0) return;
+    glifos_stroke = glGenLists(GLIFO_QUANTIDADE);
+    for (int i = 0; i < GLIFO_QUANTIDADE; ++i) {
+        glNewList(glifos_stroke + i, GL_COMPILE);
+        glutStrokeCharacter(GLUT_STROKE_ROMAN, GLIFO_PRIMEIRO + i);
+        glEndList();
+    }
+}
+
+// Funcao para desenhar texto com fonte stroke na posicao (x, y) e na escala dada
+// O texto termina no primeiro caractere fora do intervalo imprimivel
+static inline void draw_text_stroke(int x, int y, const char* text, double scale){
+    carregar_glifos_stroke();
+    glPushMatrix();
+    glTranslatef(x, y, 0);
+    glScaled(scale, scale, 1);
+    glListBase(glifos_stroke - GLIFO_PRIMEIRO);
+    int n = 0;
+    while (text[n] >= GLIFO_PRIMEIRO && text[n] < GLIFO_PRIMEIRO + GLIFO_QUANTIDADE) ++n;
+    glCallLists(n, GL_UNSIGNED_BYTE, text);
+    glPopMatrix();
+}
+
+static inline void draw_text_stroke(int x, int y, const std::string& text, double scale){
+    draw_text_stroke(x, y, text.c_str(), scale);
+}
+
+#endif
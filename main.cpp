@@ -13,6 +13,7 @@
     #include <OpenGL/gl.h>
     #include <OpenGL/glu.h>
 #else
+    #define GL_GLEXT_PROTOTYPES // pixel buffer objects (OpenGL 2.1) da captura de quadros
     #include <GL/glut.h>
     #include <GL/gl.h>
     #include <GL/glu.h>
@@ -21,11 +22,40 @@
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <forward_list>
 #include <algorithm> // Para swap
+#include <array>
 #include "glut_text.h"
 #include <vector>
 #include <queue>
+#include <iterator>
+#include <climits>
+#include <cstdint>
+#include <unordered_map>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory_resource>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <cassert>
+#if defined(__unix__) || defined(__APPLE__)
+    // Socket de dominio Unix da ingestao de comandos
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <poll.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <cerrno>
+#endif
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -34,8 +64,13 @@ using namespace std;
 #define ENTER 13
 int preto[3] {0, 0, 0};
 
+//Enumeracao com os estilos de preenchimento
+enum estilo_preenchimento{SOLIDO = 0, LINEAR, RADIAL, PADRAO }; // Cor da forma, Gradiente linear, Gradiente radial, Hachura
+int estiloAtual = SOLIDO; // estilo usado pelos proximos preenchimentos
+const char* nomesEstilos[] = {"solido", "gradiente linear", "gradiente radial", "hachura"};
+
 //Enumeracao com os tipos de formas geometricas
-enum tipo_forma{LIN = 1, TRI, QUAD, POL, TRAN, CIR }; // Linha, Triangulo, Quadrilatero, Circulo
+enum tipo_forma{LIN = 1, TRI, QUAD, POL, TRAN, CIR, SEL, INST }; // Linha, Triangulo, Quadrilatero, Circulo, Selecao, Instancia
 
 //Verifica se foi realizado o primeiro clique do mouse
 bool click1 = false;
@@ -52,6 +87,10 @@ int modo = LIN;
 //Largura e altura da janela
 int width = 512, height = 512;
 
+// Camera sobre o canvas: ponto do canvas no canto inferior esquerdo da janela
+// e quantos pixels da janela correspondem a um pixel do canvas
+double camX = 0, camY = 0, zoom = 1.0;
+
 // Definicao de vertice
 struct vertice{
     int x;
@@ -59,28 +98,298 @@ struct vertice{
     int cor[3] = {0, 0, 0};
 };
 
+// Definicao de faixa (span): pixels de xIni ate xFim, inclusive, na linha y
+struct faixa{
+    int y;
+    int xIni;
+    int xFim;
+};
+
 // Lista de vértices para os polígonos global
 static forward_list<vertice> poligonoVertices;
-// Lista de vertices pintados no flood fill
-static forward_list<vertice> floodFillVertices;
+
+typedef std::array<std::array<float, 3>, 3> matriz3;
+
+// Faixas de uma forma dentro de um ladrilho, ja recortadas a ele: primeiro as do
+// contorno, depois as do preenchimento. Sao imutaveis depois de criadas, e por isso
+// a forma, o ladrilho e as copias para outras threads compartilham o mesmo pedaco
+struct pedacoForma{
+    std::vector<faixa> faixas;
+    size_t nContorno = 0; // faixas[0..nContorno) sao do contorno
+};
+
+// Raster de uma definicao para uma parte linear da transformacao, em coordenadas
+// locais: a instancia o desloca pela parte de translacao da sua matriz
+struct rasterDefinicao{
+    std::vector<faixa> contorno;
+    std::vector<faixa> preenchimento;
+    int xMin = 0, yMin = 0, xMax = -1, yMax = -1;
+};
+
+// Definicao de forma compartilhada por instancias (carimbo)
+// A geometria e imutavel e fica em coordenadas locais, com origem no pivo da forma
+// original; os rasters sao guardados por parte linear da transformacao
+struct definicao{
+    int id;
+    int tipo;
+    forward_list<vertice> v;
+    vertice origem; // posicao original da origem no canvas, onde os rasters sao calculados
+    bool preenchido = false;
+    int estilo = 0;
+    // Preenchimento da forma original, em coordenadas locais (nContorno = 0). E o raster
+    // da parte linear identidade, pois a forma pode ter sido preenchida por flood fill,
+    // que para nos contornos das outras formas e nao pode ser refeito pelos vertices
+    std::shared_ptr<const pedacoForma> preenchimentoOriginal;
+    bool salva = false; // ja entregue ao salvamento automatico
+    std::mutex mutex; // os rasters sao consultados pelas threads das transformacoes em lote
+    std::map<std::array<long long, 4>, std::shared_ptr<const rasterDefinicao>> rasters;
+};
+int proximaDefinicao = 0;
+
+struct formaInstantanea;
+typedef std::vector<std::shared_ptr<const formaInstantanea>> listaInstantanea;
+
+// Pedacos de uma forma, um por ladrilho em que ela esta indexada. A lista tambem e
+// imutavel, e e trocada inteira a cada indexacao
+typedef std::vector<std::shared_ptr<const pedacoForma>> listaPedacos;
 
 // Definicao das formas geometricas
 struct forma{
     int tipo;
+    int id; // ordem de criacao, usada para desenhar na ordem da lista
     forward_list<vertice> v; //lista encadeada de vertices
-    forward_list<vertice> preenchidos; //lista encadeada de pixels preenchidos
+    // Faixas preenchidas em construcao: os preenchimentos e as transformacoes escrevem
+    // aqui (ver abrirFaixas), e a indexacao as reparte nos pedacos e esvazia o vetor
+    std::vector<faixa> faixas;
+    bool faixasAbertas = false; // faixas tem todo o preenchimento, e os pedacos estao desatualizados
     bool preenchido = false;
+    int estilo = SOLIDO; // estilo do preenchimento, avaliado faixa a faixa ao desenhar
+    bool selecionada = false;
     int cor[3] = {0, 0, 0};
+    // Retangulo envolvente no canvas (contorno e preenchimento), vazio se xMin > xMax
+    int xMin = 0, yMin = 0, xMax = -1, yMax = -1;
+    std::vector<long long> chaves; // ladrilhos em que a forma esta indexada
+    std::shared_ptr<const listaPedacos> pedacos; // faixas em cada ladrilho de chaves (nulos nas instancias); nulo antes da indexacao
+    bool emLote = false; // marca temporaria usada na reindexacao em lote
+    bool suja = false; // alterada desde o ultimo salvamento automatico
+    unsigned long editadaEm = 0; // versaoCena da ultima alteracao
+    // Instancias (tipo INST): nao tem vertices nem faixas proprios
+    std::shared_ptr<definicao> def;
+    std::shared_ptr<const rasterDefinicao> raster; // raster da definicao para a parte linear de matriz
+    matriz3 matriz = {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}};
+    // Ultima copia imutavel publicada para a thread de desenho
+    std::shared_ptr<const formaInstantanea> instantanea;
 };
 
 // Lista encadeada de formas geometricas
 forward_list<forma> formas;
+int proximoId = 0;
+// Incrementada a cada alteracao de forma (toda alteracao passa pela indexacao nos ladrilhos)
+unsigned long versaoCena = 0;
+
+// Canvas esparso: o plano e dividido em ladrilhos de lado fixo, alocados apenas
+// quando alguma forma os toca
+const int LADO_LADRILHO = 256;
+struct entradaLadrilho{
+    forma* f;
+    std::shared_ptr<const pedacoForma> pedaco; // nulo nas instancias, recortadas do raster ao desenhar
+};
+struct ladrilho{
+    std::vector<entradaLadrilho> formas; // formas cujo contorno ou preenchimento toca o ladrilho
+    unsigned long versao = 0; // versaoCena da ultima mudanca em formas
+    // Copia imutavel de formas publicada para a thread de desenho, e a versao copiada
+    std::shared_ptr<const listaInstantanea> instantanea;
+    unsigned long versaoInstantanea = 0;
+};
+unordered_map<long long, ladrilho> ladrilhos;
+
+// Faixas de uma forma em um ladrilho: as do seu pedaco ou, nas instancias, as do
+// raster da definicao que caem nas linhas do ladrilho, deslocadas pela translacao
+// e recortadas as colunas dele. As faixas sao numeradas de 0 a total(): primeiro
+// as do contorno, depois as do preenchimento
+struct recorteLadrilho{
+    const faixa* contorno = nullptr;
+    const faixa* preenchimento = nullptr;
+    size_t nContorno = 0, nPreenchimento = 0;
+    int dx = 0, dy = 0;
+    int xMin = 0, xMax = -1; // colunas do ladrilho
+    size_t total() const { return nContorno + nPreenchimento; }
+};
+
+/*
+ * Arena de rascunho para os buffers transitorios dos rasterizadores
+ * Aloca linearmente em blocos que nunca sao devolvidos ao sistema; cada quadro ou
+ * passada de preenchimento abre um escopoRascunho, que ao terminar rebobina a arena
+ * ate a posicao em que ela estava. Quando o escopo mais externo termina e a arena
+ * precisou de mais de um bloco, os blocos sao trocados por um unico bloco do tamanho
+ * total, de modo que em regime as passadas nao chamam o alocador global
+ */
+class arenaRascunho : public std::pmr::memory_resource {
+public:
+    ~arenaRascunho() { liberarBlocos(); }
+
+    // Posicao atual da arena, usada para rebobinar
+    struct marco {
+        size_t bloco, usado;
+    };
+    marco posicao() const { return {atual, usado}; }
+
+    void rebobinar(marco m) {
+        atual = m.bloco;
+        usado = m.usado;
+        if (profundidade == 0 && atual == 0 && usado == 0 && blocos.size() > 1) {
+            // Consolida os blocos em um so para que a proxima passada caiba nele
+            size_t total = 0;
+            for (const auto& b : blocos) total += b.tamanho;
+            liberarBlocos();
+            novoBloco(total);
+            atual = 0;
+        }
+    }
+
+    // Bytes ocupados desde o marco m
+    size_t ocupadoDesde(marco m) const {
+        size_t total = 0;
+        for (size_t i = m.bloco; i < atual && i < blocos.size(); ++i) total += blocos[i].tamanho;
+        return total + usado - m.usado;
+    }
+
+    size_t reservado() const {
+        size_t total = 0;
+        for (const auto& b : blocos) total += b.tamanho;
+        return total;
+    }
+
+    int profundidade = 0; // escopos abertos nesta thread
+    marco limite{0, 0};   // inicio do escopo mais interno
+
+    // Indica se p foi alocado a partir do marco m
+    bool alocadoDesde(marco m, const void* p) const {
+        const char* c = static_cast<const char*>(p);
+        for (size_t i = 0; i < blocos.size(); ++i) {
+            if (c >= blocos[i].dados && c < blocos[i].dados + blocos[i].tamanho)
+                return i > m.bloco || (i == m.bloco && static_cast<size_t>(c - blocos[i].dados) >= m.usado);
+        }
+        return true;
+    }
+
+private:
+    struct bloco {
+        char* dados;
+        size_t tamanho;
+    };
+    std::vector<bloco> blocos;
+    size_t atual = 0; // bloco em uso
+    size_t usado = 0; // bytes usados no bloco em uso
+
+    void novoBloco(size_t minimo) {
+        size_t tamanho = std::max<size_t>(minimo, blocos.empty() ? 64 * 1024 : 2 * blocos.back().tamanho);
+        blocos.push_back({static_cast<char*>(::operator new(tamanho)), tamanho});
+    }
+
+    void liberarBlocos() {
+        for (const auto& b : blocos) ::operator delete(b.dados);
+        blocos.clear();
+        atual = usado = 0;
+    }
+
+    void* do_allocate(size_t bytes, size_t alinhamento) override {
+        while (true) {
+            if (atual < blocos.size()) {
+                bloco& b = blocos[atual];
+                size_t inicio = (usado + alinhamento - 1) & ~(alinhamento - 1);
+                if (inicio + bytes <= b.tamanho) {
+                    usado = inicio + bytes;
+                    return b.dados + inicio;
+                }
+                // O pedido nao cabe no restante deste bloco: passa ao proximo
+                if (atual + 1 < blocos.size() && bytes + alinhamento <= blocos[atual + 1].tamanho) {
+                    ++atual;
+                    usado = 0;
+                    continue;
+                }
+            }
+            // Blocos seguintes pequenos demais sao descartados
+            while (blocos.size() > atual + 1) {
+                ::operator delete(blocos.back().dados);
+                blocos.pop_back();
+            }
+            novoBloco(bytes + alinhamento);
+            atual = blocos.size() - 1;
+            usado = 0;
+        }
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t) override {
+        // Um container de um escopo externo cresceu dentro de um escopo mais interno:
+        // o novo buffer seria descartado quando o escopo interno terminasse
+        assert(alocadoDesde(limite, p) && "container de escopo externo alterado em escopo interno");
+        // Devolve apenas a ultima alocacao (caso comum do crescimento de vetores)
+        if (atual < blocos.size() && static_cast<char*>(p) + bytes == blocos[atual].dados + usado) {
+            usado = static_cast<char*>(p) - blocos[atual].dados;
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& outro) const noexcept override {
+        return this == &outro;
+    }
+};
+
+// Cada thread tem a sua arena, pois os preenchimentos em lote rodam em paralelo
+arenaRascunho& rascunho() {
+    thread_local arenaRascunho arena;
+    return arena;
+}
+
+// Abre um escopo de rascunho; ao sair, tudo o que foi alocado nele e descartado
+// Os containers alocados no escopo devem ser destruidos antes dele, e um container
+// de um escopo externo nao pode crescer enquanto um escopo interno estiver aberto,
+// pois o novo buffer sairia do escopo interno (verificado nas compilacoes de depuracao)
+struct escopoRascunho {
+    arenaRascunho& arena;
+    arenaRascunho::marco inicio, limiteAnterior;
+    escopoRascunho() : arena(rascunho()), inicio(arena.posicao()), limiteAnterior(arena.limite) {
+        ++arena.profundidade;
+        arena.limite = inicio;
+    }
+    ~escopoRascunho() {
+        --arena.profundidade;
+        arena.limite = limiteAnterior;
+        arena.rebobinar(inicio);
+    }
+    std::pmr::memory_resource* recurso() { return &arena; }
+    size_t ocupado() const { return arena.ocupadoDesde(inicio); }
+};
+
+// Compilando com -DCONTAR_ALOCACOES, as chamadas ao alocador global sao contadas e o
+// total do ultimo quadro aparece na contabilidade de memoria (tecla m)
+#ifdef CONTAR_ALOCACOES
+std::atomic<size_t> alocacoesGlobais(0);
+size_t alocacoesUltimoQuadro = 0;
+void* operator new(size_t tamanho) {
+    ++alocacoesGlobais;
+    if (void* p = malloc(tamanho ? tamanho : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#endif
+
+void marcarSuja(forma& f);
+void indexarForma(forma& f);
+void calcularIndice(forma& f, std::vector<long long>& chaves, listaPedacos& pedacos);
+void indexarFormas(std::vector<forma*>& alvos, std::vector<std::vector<long long>>& novasChaves,
+                   std::vector<listaPedacos>& novosPedacos);
+template <typename F> void percorrerLadrilhos(int xMin, int yMin, int xMax, int yMax, F visitar);
+std::vector<faixa>& abrirFaixas(forma& f);
+void reunirFaixas(const listaPedacos* pedacos, std::vector<faixa>& faixas);
 
 // Funcao para armazenar uma forma geometrica na lista de formas
 // Armazena sempre no inicio da lista
 void pushForma(int tipo){
     forma f;
     f.tipo = tipo;
+    f.id = proximoId++;
     formas.push_front(f);
 }
 
@@ -94,34 +403,42 @@ void pushVertice(int x, int y){
 }
 
 //Fucao para armazenar uma Linha na lista de formas geometricas
-void pushLinha(int x1, int y1, int x2, int y2){
+// Com indexar = false a forma fica fora dos ladrilhos, para ser indexada em lote
+void pushLinha(int x1, int y1, int x2, int y2, bool indexar = true){
     pushForma(LIN);
     pushVertice(x1, y1);
     pushVertice(x2, y2);
+    if (indexar) indexarForma(formas.front());
 }
 
-void pushQuad(int x1, int y1, int x2, int y2) {
+void pushQuad(int x1, int y1, int x2, int y2, bool indexar = true) {
     pushForma(QUAD);
     pushVertice(x1, y1);
     pushVertice(x2, y1);
     pushVertice(x2, y2);
     pushVertice(x1, y2);
+    if (indexar) indexarForma(formas.front());
 }
 
-void pushTri(int x1, int y1, int x2, int y2, int x3, int y3) {
+void pushTri(int x1, int y1, int x2, int y2, int x3, int y3, bool indexar = true) {
     pushForma(TRI);
     pushVertice(x1, y1);
     pushVertice(x2, y2);
     pushVertice(x3, y3);
+    if (indexar) indexarForma(formas.front());
 }
 
-void pushCirculo(int x, int y, int raio) {
+void pushCirculo(int x, int y, int raio, bool indexar = true) {
     pushForma(CIR);
     pushVertice(x, y);
     pushVertice(raio, raio);
+    if (indexar) indexarForma(formas.front());
 }
 
 void preencherPoligono(forma& f);
+void preencherCirculo(forma& f);
+void atualizarRaster(forma& f);
+forma& pushInstancia(const std::shared_ptr<definicao>& def, const matriz3& matriz, const int cor[3]);
 
 // Função para calcular o centroide de uma forma
 vertice calcularCentroide(const forma& f) {
@@ -188,144 +505,250 @@ std::array<std::array<float, 3>, 3> multiplicarMatrizes(const std::array<std::ar
 }
 
 // Função para aplicar uma transformação composta a uma forma
-void aplicarTransformacaoComposta(forma& f, const std::array<std::array<float, 3>, 3>& matriz) {
+// Nos círculos só o centro é transformado, e o raio é multiplicado por escalaRaio
+void aplicarTransformacaoComposta(forma& f, const std::array<std::array<float, 3>, 3>& matriz, float escalaRaio = 1) {
+    // Nas instancias a transformacao se acumula na matriz, e o raster vem da definicao
+    if (f.tipo == INST) {
+        f.matriz = multiplicarMatrizes(matriz, f.matriz);
+        atualizarRaster(f);
+        return;
+    }
+    if (f.tipo == CIR) {
+        vertice& raio = f.v.front();
+        vertice& centro = *std::next(f.v.begin());
+        centro = aplicarTransformacao(centro, matriz);
+        raio.x = raio.y = static_cast<int>(raio.x * escalaRaio);
+        return;
+    }
     for (auto& vert : f.v) {
         vert = aplicarTransformacao(vert, matriz);
     }
 }
 
-// Função para escalar uma forma
-void escalarForma(forma& f, float fator) {
-    // Calcular o centroide da forma
-    int cx = 0, cy = 0, n = 0;
-    for (const auto& vert : f.v) {
-        cx += vert.x;
-        cy += vert.y;
-        ++n;
+// Função para limpar os pixels preenchidos de uma forma e preenchê-la novamente
+void repreencherForma(forma& f) {
+    if (!f.preenchido || f.tipo == INST) return;
+    f.faixas.clear();
+    f.faixasAbertas = true;
+    if (f.tipo == CIR) preencherCirculo(f);
+    else preencherPoligono(f);
+}
+
+// Função para calcular o pivô comum de um conjunto de formas: o centroide de
+// todos os seus vértices (nos círculos, apenas o centro)
+vertice calcularPivo(const std::vector<forma*>& alvos) {
+    long long cx = 0, cy = 0, n = 0;
+    for (const forma* f : alvos) {
+        // Instancias contribuem com a origem da sua definicao
+        if (f->tipo == INST) {
+            cx += std::lround(f->matriz[0][2]);
+            cy += std::lround(f->matriz[1][2]);
+            ++n;
+            continue;
+        }
+        if (f->tipo == CIR) {
+            const vertice& centro = *std::next(f->v.begin());
+            cx += centro.x;
+            cy += centro.y;
+            ++n;
+            continue;
+        }
+        for (const auto& vert : f->v) {
+            cx += vert.x;
+            cy += vert.y;
+            ++n;
+        }
+    }
+    if (n > 0) {
+        cx /= n;
+        cy /= n;
     }
-    cx /= n;
-    cy /= n;
+    return {static_cast<int>(cx), static_cast<int>(cy)};
+}
+
+// Função que aplica uma tarefa a cada forma do conjunto, dividindo o trabalho entre threads
+// Cada forma é tocada por uma única thread, que também calcula seus novos ladrilhos;
+// o mapa de ladrilhos é global e por isso é atualizado depois, em série
+template <typename F>
+void paraCadaForma(std::vector<forma*>& alvos, F tarefaForma) {
+    const size_t BLOCO = 64;
+    size_t n = alvos.size();
+    std::vector<std::vector<long long>> novasChaves(n);
+    std::vector<listaPedacos> novosPedacos(n);
+    auto tarefa = [&](size_t i) {
+        tarefaForma(*alvos[i]);
+        calcularIndice(*alvos[i], novasChaves[i], novosPedacos[i]);
+    };
+    // Conjuntos pequenos não compensam o custo de criar threads
+    size_t nThreads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), (n + 4 * BLOCO - 1) / (4 * BLOCO));
+    if (nThreads <= 1) {
+        for (size_t i = 0; i < n; ++i) tarefa(i);
+    } else {
+        // As threads pegam blocos de formas sob demanda, equilibrando formas de custo desigual
+        std::atomic<size_t> proximo(0);
+        auto trabalhar = [&]() {
+            for (size_t ini = proximo.fetch_add(BLOCO); ini < n; ini = proximo.fetch_add(BLOCO)) {
+                for (size_t i = ini; i < std::min(n, ini + BLOCO); ++i) tarefa(i);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < nThreads; ++t) threads.emplace_back(trabalhar);
+        trabalhar();
+        for (auto& th : threads) th.join();
+    }
+    indexarFormas(alvos, novasChaves, novosPedacos);
+}
+
+// Função para escalar um conjunto de formas em torno do pivô comum
+void escalarForma(std::vector<forma*>& alvos, float fator) {
+    vertice pivo = calcularPivo(alvos);
 
     // Criar a matriz de transformação composta
-    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-cx, -cy);
+    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-pivo.x, -pivo.y);
     auto matrizEscala = criarMatrizEscala(fator);
-    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(cx, cy);
+    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(pivo.x, pivo.y);
     auto matrizComposta = multiplicarMatrizes(multiplicarMatrizes(matrizTranslacaoDeVolta, matrizEscala), matrizTranslacaoOrigem);
 
-    // Aplicar a transformação composta aos vértices
-    aplicarTransformacaoComposta(f, matrizComposta);
-
-    // limpa os pixels preenchidos e preenche novamente
-    if (f.preenchido) {
-        f.preenchidos.clear();
-        preencherPoligono(f);
-    }
-    
+    // Aplicar a transformação composta aos vértices e preencher novamente
+    paraCadaForma(alvos, [&](forma& f) {
+        aplicarTransformacaoComposta(f, matrizComposta, fator);
+        repreencherForma(f);
+    });
 }
 
-// Função para rotacionar uma forma
-void rotacionarForma(forma& f, float angulo) {
-    // Calcular o centroide da forma
-    int cx = 0, cy = 0, n = 0;
-    for (const auto& vert : f.v) {
-        cx += vert.x;
-        cy += vert.y;
-        ++n;
-    }
-    cx /= n;
-    cy /= n;
+// Função para rotacionar um conjunto de formas em torno do pivô comum
+void rotacionarForma(std::vector<forma*>& alvos, float angulo) {
+    vertice pivo = calcularPivo(alvos);
 
     // Criar a matriz de transformação composta
-    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-cx, -cy);
+    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-pivo.x, -pivo.y);
     auto matrizRotacao = criarMatrizRotacao(angulo);
-    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(cx, cy);
+    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(pivo.x, pivo.y);
     auto matrizComposta = multiplicarMatrizes(multiplicarMatrizes(matrizTranslacaoDeVolta, matrizRotacao), matrizTranslacaoOrigem);
 
-    // Aplicar a transformação composta
-    aplicarTransformacaoComposta(f, matrizComposta);
-
-    // limpa os pixels preenchidos e preenche novamente
-    if (f.preenchido) {
-        f.preenchidos.clear();
-        preencherPoligono(f);
-    }
-
+    // Aplicar a transformação composta e preencher novamente
+    paraCadaForma(alvos, [&](forma& f) {
+        aplicarTransformacaoComposta(f, matrizComposta);
+        repreencherForma(f);
+    });
 }
 
-// Função para transladar uma forma
-void transladarForma(forma& f, float dx, float dy) {
+// Função para transladar um conjunto de formas
+void transladarForma(std::vector<forma*>& alvos, float dx, float dy) {
     auto matrizTranslacao = criarMatrizTranslacao(dx, dy);
-    aplicarTransformacaoComposta(f, matrizTranslacao);
+    paraCadaForma(alvos, [&](forma& f) {
+        aplicarTransformacaoComposta(f, matrizTranslacao);
 
-    // Aplicar a transformação composta aos pixels preenchidos
-    for (auto& p : f.preenchidos) {
-        p = aplicarTransformacao(p, matrizTranslacao);
-    }
+        // Aplicar a translação às faixas preenchidas
+        for (auto& fx : abrirFaixas(f)) {
+            fx.y += static_cast<int>(dy);
+            fx.xIni += static_cast<int>(dx);
+            fx.xFim += static_cast<int>(dx);
+        }
+    });
 }
 
-// Função para cisalhar uma forma em torno do centroide
-void cisalharForma(forma& f, float dx, float dy) {
-    // Calcular o centroide da forma
-    int cx = 0, cy = 0, n = 0;
-    for (const auto& vert : f.v) {
-        cx += vert.x;
-        cy += vert.y;
-        ++n;
-    }
-    cx /= n;
-    cy /= n;
+// Função para cisalhar um conjunto de formas em torno do pivô comum
+void cisalharForma(std::vector<forma*>& alvos, float dx, float dy) {
+    vertice pivo = calcularPivo(alvos);
 
     // Criar a matriz de transformação composta
-    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-cx, -cy);
+    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-pivo.x, -pivo.y);
     auto matrizCisalhamento = std::array<std::array<float, 3>, 3> {{
         {1, dx, 0},
         {dy, 1, 0},
         {0, 0, 1}
     }};
-    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(cx, cy);
+    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(pivo.x, pivo.y);
     auto matrizComposta = multiplicarMatrizes(multiplicarMatrizes(matrizTranslacaoDeVolta, matrizCisalhamento), matrizTranslacaoOrigem);
 
-    // Aplicar a transformação composta
-    aplicarTransformacaoComposta(f, matrizComposta);
-
-    // limpa os pixels preenchidos e preenche novamente
-    if (f.preenchido) {
-        f.preenchidos.clear();
-        preencherPoligono(f);
-    }
+    // Aplicar a transformação composta e preencher novamente
+    paraCadaForma(alvos, [&](forma& f) {
+        aplicarTransformacaoComposta(f, matrizComposta);
+        repreencherForma(f);
+    });
 }
 
-// Função para refletir uma forma
-void refletirForma(forma& f, bool vertical, bool horizontal) {
-    // Calcular o centroide da forma
-    int cx = 0, cy = 0, n = 0;
-    for (const auto& vert : f.v) {
-        cx += vert.x;
-        cy += vert.y;
-        ++n;
-    }
-    cx /= n;
-    cy /= n;
+// Função para refletir um conjunto de formas em torno do pivô comum
+void refletirForma(std::vector<forma*>& alvos, bool vertical, bool horizontal) {
+    vertice pivo = calcularPivo(alvos);
 
     // Criar a matriz de transformação composta
-    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-cx, -cy);
+    auto matrizTranslacaoOrigem = criarMatrizTranslacao(-pivo.x, -pivo.y);
     auto matrizReflexao = std::array<std::array<float, 3>, 3> {{
         {horizontal ? -1.0f : 1.0f, 0.0f, 0.0f},
         {0.0f, vertical ? -1.0f : 1.0f, 0.0f},
         {0.0f, 0.0f, 1.0f}
     }};
-    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(cx, cy);
+    auto matrizTranslacaoDeVolta = criarMatrizTranslacao(pivo.x, pivo.y);
     auto matrizComposta = multiplicarMatrizes(multiplicarMatrizes(matrizTranslacaoDeVolta, matrizReflexao), matrizTranslacaoOrigem);
 
-    // Aplicar a transformação composta
-    aplicarTransformacaoComposta(f, matrizComposta);
+    paraCadaForma(alvos, [&](forma& f) {
+        // Aplicar a transformação composta
+        aplicarTransformacaoComposta(f, matrizComposta);
+
+        // As faixas continuam horizontais: basta refletir as duas extremidades
+        for (auto& fx : abrirFaixas(f)) {
+            vertice ini = aplicarTransformacao({fx.xIni, fx.y}, matrizComposta);
+            vertice fim = aplicarTransformacao({fx.xFim, fx.y}, matrizComposta);
+            fx.y = ini.y;
+            fx.xIni = std::min(ini.x, fim.x);
+            fx.xFim = std::max(ini.x, fim.x);
+        }
+    });
+}
+
+// Seleção de formas: as transformações se aplicam a todas as formas selecionadas,
+// ou apenas à última forma desenhada quando nada está selecionado
+std::vector<forma*> selecao;
+bool arrastando = false; // retângulo de seleção em andamento
+
+// Função para esvaziar a seleção
+void limparSelecao() {
+    for (forma* f : selecao) f->selecionada = false;
+    selecao.clear();
+}
+
+// Função para acrescentar uma forma à seleção
+void selecionar(forma* f) {
+    if (f->selecionada) return;
+    f->selecionada = true;
+    selecao.push_back(f);
+}
+
+// Função para selecionar as formas contidas inteiramente em um retângulo
+void selecionarRetangulo(int x1, int y1, int x2, int y2) {
+    limparSelecao();
+    int xMin = std::min(x1, x2), xMax = std::max(x1, x2);
+    int yMin = std::min(y1, y2), yMax = std::max(y1, y2);
+    // Uma forma contida no retângulo só ocupa ladrilhos que o tocam
+    percorrerLadrilhos(xMin, yMin, xMax, yMax, [&](ladrilho& t, int, int) {
+        for (const auto& e : t.formas) {
+            forma* f = e.f;
+            if (f->xMin >= xMin && f->xMax <= xMax && f->yMin >= yMin && f->yMax <= yMax) {
+                selecionar(f);
+            }
+        }
+    });
+}
 
-    // Aplicar a transformação composta aos pixels preenchidos
-    for (auto& p : f.preenchidos) {
-        p = aplicarTransformacao(p, matrizComposta);
+// Função para selecionar a forma mais recente cujo retângulo envolvente contém o ponto
+void selecionarPonto(int x, int y) {
+    limparSelecao();
+    for (auto& f : formas) {
+        if (x >= f.xMin && x <= f.xMax && y >= f.yMin && y <= f.yMax) {
+            selecionar(&f);
+            return;
+        }
     }
 }
 
+// Função para selecionar todas as formas
+void selecionarTodas() {
+    limparSelecao();
+    for (auto& f : formas) selecionar(&f);
+}
+
 
 
 /*
@@ -333,17 +756,105 @@ void refletirForma(forma& f, bool vertical, bool horizontal) {
  */
 void init(void);
 void reshape(int w, int h);
+void aplicarCamera();
+void janelaParaCanvas(int x, int y, int& cx, int& cy);
 void display(void);
 void menu_popup(int value);
 void keyboard(unsigned char key, int x, int y);
 void mouse(int button, int state, int x, int y);
 void mousePassiveMotion(int x, int y);
+void mouseMotion(int x, int y);
+void special(int key, int x, int y);
 void drawPixel(int x, int y, int cor[3]);
+void drawFaixa(int y, int xIni, int xFim, int cor[3]);
+void desenharRetangulo(int x1, int y1, int x2, int y2, int cor[3]);
+void desenharSelecao();
 // Funcao que percorre a lista de formas geometricas, desenhando-as na tela
 void drawFormas();
+void desenharLadrilho(const ladrilho& t, int tx, int ty);
+void desenharPrevia();
+void coletarVisiveis(std::pmr::vector<forma*>& visiveis);
+void desenharForma(const forma& f);
+void desenharRecorte(const forma& f, const recorteLadrilho& r, size_t ini, size_t fim);
+void desenharProgressivo();
+template <typename F> void avaliarFaixa(const F& f, int y, int xIni, int xFim, uint32_t* rgba);
 void retaBresenhan(int x1, int y1, int x2, int y2);
 void circuloBresenhan(int x, int y, int raio);
+template <typename P> void rasterizarReta(int x1, int y1, int x2, int y2, P faixa);
+template <typename P> void rasterizarCirculo(int x, int y, int raio, P faixa);
+template <typename P> void rasterizarContorno(const forma& f, P faixa);
+int ladrilhoDe(int c);
+long long chaveLadrilho(int tx, int ty);
+void coordenadasLadrilho(long long chave, int& tx, int& ty);
+recorteLadrilho recortarLadrilho(const pedacoForma* pedaco, const rasterDefinicao* raster, int dx, int dy, int tx, int ty);
+recorteLadrilho recorteDe(const forma& f, const pedacoForma* pedaco, int tx, int ty);
+bool faixaDoRecorte(const recorteLadrilho& r, size_t i, int& y, int& xIni, int& xFim);
+void rasterizarMascara(int tx, int ty, std::pmr::vector<uint64_t>& mascara);
 void preencherTodasFormas();
+void preencherCena();
+void pedirRedesenho();
+void registrarPico(std::atomic<size_t>& pico, size_t bytes);
+size_t custoAlocacao(size_t pedido);
+void desenharMemoria();
+void salvarMemoriaJSON(const char* caminho);
+
+// Pico de memoria transitoria de cada rasterizador (bytes ocupados na arena de rascunho)
+std::atomic<size_t> picoPreencherPoligono(0), picoFloodFill(0), picoPreencherCena(0);
+bool mostrarMemoria = false; // exibe a contabilidade de memoria na tela
+void gravarEvento(char tipo, int a, int b, int c, int d);
+bool carregarTrilha(const char* caminho);
+void reproduzirPasso();
+void reproduzirSemJanela();
+void quadroConcluido();
+bool recuperarFormas(const char* caminho);
+void iniciarAutosalvamento();
+void autosalvarPasso(int valor);
+void iniciarCaptura();
+void alternarCaptura();
+void capturarQuadro();
+void iniciarDesenhoEmThread();
+void exibirDesenhoEmThread();
+
+// Carimbo: definicao e transformacao usadas pelas instancias criadas no modo INST
+struct estadoCarimbo{
+    std::shared_ptr<definicao> def;
+    matriz3 matriz; // parte linear aplicada as novas instancias
+    int cor[3] = {0, 0, 0};
+} carimbo;
+bool criarCarimbo(forma& f);
+
+// Renderizacao progressiva
+bool renderizacaoProgressiva = false; // desenha as formas ao longo de varios quadros
+double orcamentoQuadro = 8.0; // ms de desenho de formas por quadro no modo progressivo
+bool conferirProgressivo = false; // compara cada quadro progressivo concluido com drawFormas
+void conferirQuadroProgressivo();
+
+// Desenho em thread separada
+bool desenhoEmThread = false; // as formas sao rasterizadas por uma thread a partir de copias imutaveis da cena
+const int INTERVALO_VERIFICAR_DESENHO = 8; // ms entre verificacoes de quadro pronto
+
+// Ingestao de comandos por socket local
+const char* socketIngestao = nullptr; // caminho do socket de dominio Unix, se houver
+const int INTERVALO_INGESTAO = 16; // ms entre aplicacoes dos comandos recebidos
+bool iniciarIngestao();
+void ingestaoPasso(int valor);
+
+// Salvamento automatico
+const char* arquivoAutosalvar = "autosave.paint"; // nullptr desliga o salvamento automatico
+const int INTERVALO_AUTOSALVAR = 2000; // ms entre dois salvamentos
+
+// Captura de quadros em video
+const char* arquivoCaptura = "captura.y4m";
+bool capturarAoIniciar = false; // --capturar: comeca a captura com a janela
+bool capturandoQuadros();
+
+// Gravacao e reproducao de entrada
+FILE* arquivoGravacao = nullptr; // trilha sendo gravada, se houver
+bool reproduzindo = false; // alimenta os callbacks com uma trilha gravada
+bool reproducaoRapida = false; // ignora os tempos gravados e reproduz o mais rapido possivel
+bool semJanela = false; // reproduz sem criar janela nem contexto OpenGL
+bool redesenhoPendente = false;
+std::chrono::steady_clock::time_point inicioRelogio = std::chrono::steady_clock::now();
 
 
 
@@ -351,6 +862,58 @@ void preencherTodasFormas();
  * Funcao principal
  */
 int main(int argc, char** argv){
+    // Opcoes de gravacao e reproducao da entrada
+    for (int i = 1; i < argc; ++i) {
+        std::string opcao = argv[i];
+        if (opcao == "--gravar" && i + 1 < argc) {
+            arquivoGravacao = fopen(argv[++i], "w");
+            if (!arquivoGravacao) {
+                fprintf(stderr, "Nao foi possivel criar a trilha %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (opcao == "--reproduzir" && i + 1 < argc) {
+            if (!carregarTrilha(argv[++i])) {
+                fprintf(stderr, "Nao foi possivel ler a trilha %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            reproduzindo = true;
+        } else if (opcao == "--rapido") {
+            reproducaoRapida = true;
+        } else if (opcao == "--sem-janela") {
+            semJanela = true;
+        } else if (opcao == "--autosalvar" && i + 1 < argc) {
+            arquivoAutosalvar = argv[++i];
+        } else if (opcao == "--sem-autosalvar") {
+            arquivoAutosalvar = nullptr;
+        } else if (opcao == "--orcamento" && i + 1 < argc) {
+            orcamentoQuadro = std::max(0.1, atof(argv[++i]));
+            renderizacaoProgressiva = true;
+        } else if (opcao == "--conferir-progressivo") {
+            conferirProgressivo = true;
+            renderizacaoProgressiva = true;
+        } else if (opcao == "--socket" && i + 1 < argc) {
+            socketIngestao = argv[++i];
+        } else if (opcao == "--thread-desenho") {
+            desenhoEmThread = true;
+        } else if (opcao == "--capturar" && i + 1 < argc) {
+            arquivoCaptura = argv[++i];
+            capturarAoIniciar = true;
+        } else if (opcao == "--recuperar" && i + 1 < argc) {
+            if (!recuperarFormas(argv[++i])) {
+                fprintf(stderr, "Nao foi possivel recuperar %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (semJanela) {
+        if (!reproduzindo) {
+            fprintf(stderr, "--sem-janela exige --reproduzir\n");
+            return EXIT_FAILURE;
+        }
+        reproduzirSemJanela();
+        return EXIT_SUCCESS;
+    }
+
     glutInit(&argc, argv); // Passagens de parametro C para o glut
     glutInitDisplayMode (GLUT_DOUBLE | GLUT_RGB); //Selecao do Modo do Display e do Sistema de cor
     glutInitWindowSize (width, height);  // Tamanho da janela do OpenGL
@@ -361,6 +924,8 @@ int main(int argc, char** argv){
     glutKeyboardFunc(keyboard); //funcao callback do teclado
     glutMouseFunc(mouse); //funcao callback do mouse
     glutPassiveMotionFunc(mousePassiveMotion); //fucao callback do movimento passivo do mouse
+    glutMotionFunc(mouseMotion); //funcao callback do movimento do mouse com botao pressionado
+    glutSpecialFunc(special); //funcao callback das teclas especiais (setas)
     glutDisplayFunc(display); //funcao callback de desenho
     
     // Criação do Menu
@@ -370,10 +935,26 @@ int main(int argc, char** argv){
     glutAddMenuEntry("Triangulo", TRI);
     glutAddMenuEntry("Poligono", POL);
     glutAddMenuEntry("Circulo", CIR);
+    glutAddMenuEntry("Selecionar", SEL);
     glutAddMenuEntry("Sair", 0);
     glutAttachMenu(GLUT_RIGHT_BUTTON);
 
-    
+    if (reproduzindo) glutIdleFunc(reproduzirPasso); // alimenta os eventos gravados
+    // Sessoes reproduzidas sao testes de desempenho e nao sobrescrevem o salvamento
+    if (arquivoAutosalvar && !reproduzindo) {
+        iniciarAutosalvamento();
+        glutTimerFunc(INTERVALO_AUTOSALVAR, autosalvarPasso, 0);
+    }
+    if (capturarAoIniciar) iniciarCaptura();
+    if (desenhoEmThread) iniciarDesenhoEmThread();
+    if (socketIngestao) {
+        if (!iniciarIngestao()) {
+            fprintf(stderr, "Nao foi possivel abrir o socket %s\n", socketIngestao);
+            return EXIT_FAILURE;
+        }
+        glutTimerFunc(INTERVALO_INGESTAO, ingestaoPasso, 0);
+    }
+
     glutMainLoop(); // executa o loop do OpenGL
     return EXIT_SUCCESS; // retorna 0 para o tipo inteiro da funcao main();
 }
@@ -390,41 +971,91 @@ void init(void){
  */
 void reshape(int w, int h)
 {
+    gravarEvento('r', w, h, 0, 0);
+    width = w;
+    height = h;
+    if (semJanela) return;
+
     // Muda para o modo de projecao e reinicializa o sistema de coordenadas
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
 
     // Definindo o Viewport para o tamanho da janela
     glViewport(0, 0, w, h);
-    
-    width = w;
-    height = h;
-    glOrtho (0, w, 0, h, -1 ,1);
+    aplicarCamera();
+}
+
+/*
+ * Ajusta a projecao para mostrar a regiao do canvas vista pela camera
+ */
+void aplicarCamera(){
+    if (semJanela) return;
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(camX, camX + width / zoom, camY, camY + height / zoom, -1, 1);
+    glPointSize(std::max(1.0, zoom));
+    glPixelZoom(zoom, zoom); // linhas de preenchimento com estilo
 
-   // muda para o modo de desenho
+    // muda para o modo de desenho
     glMatrixMode(GL_MODELVIEW);
-     glLoadIdentity();
+    glLoadIdentity();
+}
 
+/*
+ * Converte a posicao do mouse na janela (origem no canto superior esquerdo)
+ * para coordenadas do canvas
+ */
+void janelaParaCanvas(int x, int y, int& cx, int& cy){
+    cx = static_cast<int>(std::floor(camX + x / zoom));
+    cy = static_cast<int>(std::floor(camY + (height - y - 1) / zoom));
 }
 
 /*
  * Controla os desenhos na tela
  */
 void display(void){
+    escopoRascunho escopo; // buffers transitorios do quadro
+#ifdef CONTAR_ALOCACOES
+    size_t alocacoesAntes = alocacoesGlobais;
+#endif
     glClear(GL_COLOR_BUFFER_BIT); //Limpa o buffer de cores e reinicia a matriz
     glColor3f (0.0, 0.0, 0.0); // Seleciona a cor default como preto
-    drawFormas(); // Desenha as formas geometricas da lista
-    //Desenha texto com as coordenadas da posicao do mouse
-    draw_text_stroke(0, 0, "(" + to_string(m_x) + "," + to_string(m_y) + ")", 0.2);
+    if (desenhoEmThread) exibirDesenhoEmThread();
+    else if (renderizacaoProgressiva) desenharProgressivo();
+    else drawFormas(); // Desenha as formas geometricas da lista
+    //Desenha texto com as coordenadas da posicao do mouse, em coordenadas da janela
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0, width, 0, height, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    char coordenadas[64]; // formatado na pilha, sem alocacao por quadro
+    if (estiloAtual == SOLIDO) snprintf(coordenadas, sizeof(coordenadas), "(%d,%d)", m_x, m_y);
+    else snprintf(coordenadas, sizeof(coordenadas), "(%d,%d) %s", m_x, m_y, nomesEstilos[estiloAtual]);
+    draw_text_stroke(0, 0, coordenadas, 0.2);
+    if (mostrarMemoria) desenharMemoria();
+    if (capturandoQuadros()) capturarQuadro(); // le o quadro concluido sem esperar a copia
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+#ifdef CONTAR_ALOCACOES
+    alocacoesUltimoQuadro = alocacoesGlobais - alocacoesAntes;
+#endif
     glutSwapBuffers(); // manda o OpenGl renderizar as primitivas
+    if (reproduzindo) quadroConcluido();
 }
 
 /*
  * Controla o menu pop-up
  */
 void menu_popup(int value){
+    gravarEvento('u', value, 0, 0, 0);
     if (value == 0) exit(EXIT_SUCCESS);
     modo = value;
+    if (modo != SEL) {
+        limparSelecao();
+        pedirRedesenho();
+    }
 }
 
 
@@ -432,6 +1063,7 @@ void menu_popup(int value){
  * Controle das teclas comuns do teclado
  */
 void keyboard(unsigned char key, int x, int y){
+    gravarEvento('k', key, x, y, 0);
     switch (key) { // key - variavel que possui valor ASCII da tecla precionada
         case ESC: exit(EXIT_SUCCESS); break;
         case ENTER: {
@@ -441,17 +1073,24 @@ void keyboard(unsigned char key, int x, int y){
                     for (const auto& vert : poligonoVertices) {
                         pushVertice(vert.x, vert.y);
                     }
+                    indexarForma(formas.front());
                     poligonoVertices.clear();
-                    glutPostRedisplay();
+                    pedirRedesenho();
                 }
             }
             break;
         }
         // Função tecle "p" para preencher o último polígono
         case 'p': {
-            if (!formas.empty() && formas.front().tipo != CIR && formas.front().tipo != LIN) {
-                preencherPoligono(formas.front());
-                glutPostRedisplay();
+            if (!formas.empty() && !formas.front().preenchido) formas.front().estilo = estiloAtual;
+            if (!formas.empty() && formas.front().tipo == CIR) {
+                if (!formas.front().preenchido) preencherCirculo(formas.front());
+                indexarForma(formas.front());
+                pedirRedesenho();
+            } else if (!formas.empty() && formas.front().tipo != LIN && formas.front().tipo != INST) {
+                if (!formas.front().preenchido) preencherPoligono(formas.front());
+                indexarForma(formas.front());
+                pedirRedesenho();
             }
             break;
         }
@@ -459,69 +1098,139 @@ void keyboard(unsigned char key, int x, int y){
         case 'f': {
             if (!formas.empty()) {
                 preencherTodasFormas();
-                glutPostRedisplay();
+                pedirRedesenho();
+            }
+            break;
+        }
+        // Teclas "+" e "-" para aproximar e afastar a camera, mantendo o centro da janela
+        case '+':
+        case '-': {
+            double fator = key == '+' ? 1.25 : 0.8;
+            double centroX = camX + width / (2 * zoom), centroY = camY + height / (2 * zoom);
+            zoom = std::min(64.0, std::max(1.0 / 256, zoom * fator));
+            camX = centroX - width / (2 * zoom);
+            camY = centroY - height / (2 * zoom);
+            aplicarCamera();
+            pedirRedesenho();
+            break;
+        }
+        // Função tecle "i" para transformar a forma selecionada (ou a última desenhada)
+        // em carimbo e entrar no modo de carimbo: cada clique cria uma instância
+        case 'i': {
+            forma* origem = !selecao.empty() ? selecao.front() : (!formas.empty() ? &formas.front() : nullptr);
+            if (origem && criarCarimbo(*origem)) {
+                modo = INST;
+                click1 = false;
+                pedirRedesenho();
+            }
+            break;
+        }
+        // Função tecle "g" para alternar o estilo dos próximos preenchimentos
+        case 'g': {
+            estiloAtual = (estiloAtual + 1) % 4;
+            pedirRedesenho(); // o estilo aparece ao lado das coordenadas
+            break;
+        }
+        // Função tecle "b" para ligar ou desligar a renderização progressiva
+        case 'b': {
+            renderizacaoProgressiva = !renderizacaoProgressiva;
+            pedirRedesenho();
+            break;
+        }
+        // Função tecle "t" para ligar ou desligar o desenho em thread separada
+        case 't': {
+            desenhoEmThread = !desenhoEmThread;
+            if (desenhoEmThread) iniciarDesenhoEmThread();
+            pedirRedesenho();
+            break;
+        }
+        // Função tecle "m" para mostrar ou esconder a contabilidade de memória
+        case 'm': {
+            mostrarMemoria = !mostrarMemoria;
+            pedirRedesenho();
+            break;
+        }
+        // Função tecle "M" para gravar a contabilidade de memória em JSON
+        case 'M': {
+            salvarMemoriaJSON("memoria.json");
+            break;
+        }
+        // Função tecle "A" para selecionar todas as formas
+        case 'A': {
+            selecionarTodas();
+            pedirRedesenho();
+            break;
+        }
+        // Função tecle "F" para preencher todas as formas não preenchidas em uma única varredura
+        case 'F': {
+            if (!formas.empty()) {
+                preencherCena();
+                pedirRedesenho();
             }
             break;
         }
     }
     // Controle de teclas para as transformações geométricas
-    if (!formas.empty() && formas.front().tipo != CIR) {
+    // Aplicadas à seleção ou, se ela estiver vazia, à última forma desenhada
+    if (!formas.empty()) {
+        std::vector<forma*> alvos = selecao;
+        if (alvos.empty()) alvos.push_back(&formas.front());
         bool redisplay = true;
         switch (key) {
             case 'w': {
-                transladarForma(formas.front(), 0, 10);
+                transladarForma(alvos, 0, 10);
                 break;
             }
             case 's': {
-                transladarForma(formas.front(), 0, -10);
+                transladarForma(alvos, 0, -10);
                 break;
             }
             case 'a': {
-                transladarForma(formas.front(), -10, 0);
+                transladarForma(alvos, -10, 0);
                 break;
             }
             case 'd': {
-                transladarForma(formas.front(), 10, 0);
+                transladarForma(alvos, 10, 0);
                 break;
             }
             case 'E': {
-                escalarForma(formas.front(), 0.9);
+                escalarForma(alvos, 0.9);
                 break;
             }
             case 'e': {
-                escalarForma(formas.front(), 1.1);
+                escalarForma(alvos, 1.1);
                 break;
             }
             case 'r': {
-                rotacionarForma(formas.front(), -10);
+                rotacionarForma(alvos, -10);
                 break;
             }
             case 'R': {
-                rotacionarForma(formas.front(), 10);
+                rotacionarForma(alvos, 10);
                 break;
             }
             case 'c': {
-                cisalharForma(formas.front(), 0.1, 0);
+                cisalharForma(alvos, 0.1, 0);
                 break;
             }
             case 'C': {
-                cisalharForma(formas.front(), -0.1, 0);
+                cisalharForma(alvos, -0.1, 0);
                 break;
             }
             case 'y': {
-                cisalharForma(formas.front(), 0, 0.1);
+                cisalharForma(alvos, 0, 0.1);
                 break;
             }
             case 'Y': {
-                cisalharForma(formas.front(), 0, -0.1);
+                cisalharForma(alvos, 0, -0.1);
                 break;
             }
             case 'v': {
-                refletirForma(formas.front(), true, false);
+                refletirForma(alvos, true, false);
                 break;
             }
             case 'h': {
-                refletirForma(formas.front(), false, true);
+                refletirForma(alvos, false, true);
                 break;
             }
             default: {
@@ -530,7 +1239,7 @@ void keyboard(unsigned char key, int x, int y){
             }
         }
         if (redisplay) {
-            glutPostRedisplay();
+            pedirRedesenho();
         }
     }
 }
@@ -539,6 +1248,7 @@ void keyboard(unsigned char key, int x, int y){
  * Controle dos botoes do mouse
  */
 void mouse(int button, int state, int x, int y){
+    gravarEvento('m', button, state, x, y);
     switch (button) {
         case GLUT_LEFT_BUTTON:
             switch(modo){
@@ -546,15 +1256,13 @@ void mouse(int button, int state, int x, int y){
                 case LIN:
                     if (state == GLUT_DOWN) {
                         if(click1){
-                            x_2 = x;
-                            y_2 = height - y - 1;
+                            janelaParaCanvas(x, y, x_2, y_2);
                             pushLinha(x_1, y_1, x_2, y_2);
                             click1 = false;
-                            glutPostRedisplay();
+                            pedirRedesenho();
                         }else{
                             click1 = true;
-                            x_1 = x;
-                            y_1 = height - y - 1;
+                            janelaParaCanvas(x, y, x_1, y_1);
                         }
                     }
                 break;
@@ -562,15 +1270,13 @@ void mouse(int button, int state, int x, int y){
                 case QUAD:
                     if (state == GLUT_DOWN) {
                         if (click1) {
-                            x_2 = x;
-                            y_2 = height - y - 1;
+                            janelaParaCanvas(x, y, x_2, y_2);
                             pushQuad(x_1, y_1, x_2, y_2);
                             click1 = false;
-                            glutPostRedisplay();
+                            pedirRedesenho();
                         }else{
                             click1 = true;
-                            x_1 = x;
-                            y_1 = height - y - 1;
+                            janelaParaCanvas(x, y, x_1, y_1);
                         }
                     }
                 break;
@@ -578,27 +1284,25 @@ void mouse(int button, int state, int x, int y){
                     if (state == GLUT_DOWN) {
                         static int clickCount = 0;
                         if (clickCount == 0) {
-                            x_1 = x;
-                            y_1 = height - y - 1;
+                            janelaParaCanvas(x, y, x_1, y_1);
                             clickCount++;
                         } else if (clickCount == 1) {
-                            x_2 = x;
-                            y_2 = height - y - 1;
+                            janelaParaCanvas(x, y, x_2, y_2);
                             clickCount++;
                         } else if (clickCount == 2) {
-                            int x_3 = x;
-                            int y_3 = height - y - 1;
+                            int x_3, y_3;
+                            janelaParaCanvas(x, y, x_3, y_3);
                             pushTri(x_1, y_1, x_2, y_2, x_3, y_3);
                             clickCount = 0;
-                            glutPostRedisplay();
+                            pedirRedesenho();
                         }
                     }
                 break;
                 // Controle do mouse para poligono com 4+ vertices
                 case POL:
                     if (state == GLUT_DOWN) {
-                        int x_click = x;
-                        int y_click = height - y - 1;
+                        int x_click, y_click;
+                        janelaParaCanvas(x, y, x_click, y_click);
                         poligonoVertices.push_front({x_click, y_click}); // Adiciona o vértice
                     }
                 break;
@@ -606,18 +1310,60 @@ void mouse(int button, int state, int x, int y){
                 case CIR:
                     if (state == GLUT_DOWN) {
                         if (click1) {
-                            x_2 = x;
-                            y_2 = height - y - 1;
+                            janelaParaCanvas(x, y, x_2, y_2);
                             int raio = sqrt(pow(x_2 - x_1, 2) + pow(y_2 - y_1, 2));
                             pushCirculo(x_1, y_1, raio);
                             click1 = false;
-                            glutPostRedisplay();
+                            pedirRedesenho();
                         } else {
                             click1 = true;
-                            x_1 = x;
-                            y_1 = height - y - 1;
+                            janelaParaCanvas(x, y, x_1, y_1);
+                        }
+                    }
+                break;
+                // Controle do mouse para carimbo: cada clique cria uma instancia centrada no ponto
+                case INST:
+                    if (state == GLUT_DOWN && carimbo.def) {
+                        int cx, cy;
+                        janelaParaCanvas(x, y, cx, cy);
+                        matriz3 matriz = carimbo.matriz;
+                        matriz[0][2] = cx;
+                        matriz[1][2] = cy;
+                        indexarForma(pushInstancia(carimbo.def, matriz, carimbo.cor));
+                        pedirRedesenho();
+                    }
+                break;
+                // Controle do mouse para selecao: clique seleciona uma forma, arrasto seleciona por retangulo
+                case SEL:
+                    if (state == GLUT_DOWN) {
+                        arrastando = true;
+                        janelaParaCanvas(x, y, x_1, y_1);
+                        m_x = x_1;
+                        m_y = y_1;
+                    } else if (arrastando) {
+                        arrastando = false;
+                        janelaParaCanvas(x, y, x_2, y_2);
+                        if (abs(x_2 - x_1) * zoom <= 2 && abs(y_2 - y_1) * zoom <= 2) {
+                            selecionarPonto(x_2, y_2);
+                        } else {
+                            selecionarRetangulo(x_1, y_1, x_2, y_2);
                         }
+                        pedirRedesenho();
                     }
+                break;
+            }
+        break;
+        // Roda do mouse (freeglut): aproxima ou afasta mantendo fixo o ponto sob o cursor
+        case 3:
+        case 4:
+            if (state == GLUT_DOWN) {
+                double fator = button == 3 ? 1.25 : 0.8;
+                double px = camX + x / zoom, py = camY + (height - y - 1) / zoom;
+                zoom = std::min(64.0, std::max(1.0 / 256, zoom * fator));
+                camX = px - x / zoom;
+                camY = py - (height - y - 1) / zoom;
+                aplicarCamera();
+                pedirRedesenho();
             }
         break;
     }
@@ -627,8 +1373,41 @@ void mouse(int button, int state, int x, int y){
  * Controle da posicao do cursor do mouse
  */
 void mousePassiveMotion(int x, int y){
-    m_x = x; m_y = height - y - 1;
-    glutPostRedisplay();
+    gravarEvento('p', x, y, 0, 0);
+    janelaParaCanvas(x, y, m_x, m_y);
+    pedirRedesenho();
+}
+
+/*
+ * Controle da posicao do cursor do mouse com botao pressionado
+ */
+void mouseMotion(int x, int y){
+    gravarEvento('n', x, y, 0, 0);
+    janelaParaCanvas(x, y, m_x, m_y);
+    pedirRedesenho();
+}
+
+/*
+ * Controle das teclas especiais: as setas deslocam a camera sobre o canvas
+ */
+void special(int key, int x, int y){
+    gravarEvento('s', key, x, y, 0);
+    if (key == GLUT_KEY_F9) {
+        alternarCaptura();
+        return;
+    }
+    // Desloca um decimo da area visivel
+    double passoX = width / (10 * zoom), passoY = height / (10 * zoom);
+    switch (key) {
+        case GLUT_KEY_LEFT: camX -= passoX; break;
+        case GLUT_KEY_RIGHT: camX += passoX; break;
+        case GLUT_KEY_UP: camY += passoY; break;
+        case GLUT_KEY_DOWN: camY -= passoY; break;
+        default: return;
+    }
+    aplicarCamera();
+    janelaParaCanvas(x, y, m_x, m_y);
+    pedirRedesenho();
 }
 
 /*
@@ -641,90 +1420,278 @@ void drawPixel(int x, int y, int cor[3]){
     glEnd();
 }
 
+/*
+ * Funcao para desenhar uma faixa horizontal de pixels na tela
+ */
+void drawFaixa(int y, int xIni, int xFim, int cor[3]){
+    glColor3ub(cor[0], cor[1], cor[2]);
+    glRecti(xIni, y, xFim + 1, y + 1);
+}
+
 /*
  * Funcao que desenha a lista de formas geometricas
+ * Cada ladrilho visivel e desenhado com os pedacos das suas formas, na ordem da lista
+ * de formas (da mais recente para a mais antiga); como um pedaco so tem pixels do
+ * seu ladrilho, o resultado e o mesmo de desenhar as formas inteiras nessa ordem
  */
 void drawFormas() {
+    desenharPrevia();
+
+    // Regiao do canvas visivel na janela
+    int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+    int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+    int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+
+    percorrerLadrilhos(vxMin, vyMin, vxMax, vyMax, [&](ladrilho& t, int tx, int ty) { desenharLadrilho(t, tx, ty); });
+
+    // Destaca as formas selecionadas com o retangulo envolvente
+    desenharSelecao();
+}
+
+/*
+ * Funcao que desenha os pedacos do ladrilho (tx, ty) das formas que cruzam a janela,
+ * na ordem da lista de formas
+ */
+void desenharLadrilho(const ladrilho& t, int tx, int ty) {
+    // Regiao do canvas visivel na janela
+    int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+    int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+    int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+
+    escopoRascunho escopo;
+    std::pmr::vector<const entradaLadrilho*> entradas(escopo.recurso());
+    for (const auto& e : t.formas) {
+        const forma* f = e.f;
+        if (f->xMax >= vxMin && f->xMin <= vxMax && f->yMax >= vyMin && f->yMin <= vyMax) entradas.push_back(&e);
+    }
+    std::sort(entradas.begin(), entradas.end(), [](const entradaLadrilho* a, const entradaLadrilho* b) {
+        return a->f->id > b->f->id;
+    });
+    for (const entradaLadrilho* e : entradas) {
+        recorteLadrilho r = recorteDe(*e->f, e->pedaco.get(), tx, ty);
+        desenharRecorte(*e->f, r, 0, r.total());
+    }
+}
+
+/*
+ * Funcao que desenha o que acompanha o mouse: a reta em construcao e o retangulo de selecao
+ */
+void desenharPrevia() {
     // Apos o primeiro clique, desenha a reta com a posicao atual do mouse
     if (click1 && modo == LIN) retaBresenhan(x_1, y_1, m_x, m_y);
-    
-    // Percorre a lista de formas geometricas para desenhar
-    for (auto& f : formas) {
-        switch (f.tipo) {
-            // Desenha linha
-            case LIN: {
-                int i = 0, x[2], y[2];
-                // Percorre a lista de vertices da forma linha para desenhar
-                for (auto& v : f.v) {
-                    x[i] = v.x;
-                    y[i] = v.y;
-                    ++i;
-                }
-                // Desenha o segmento de reta apos dois cliques
-                retaBresenhan(x[0], y[0], x[1], y[1]);
-                break;
-            }
-            // Desenha quadrilatero com 2 pontos
-            case QUAD: {
-                int i = 0, x[4], y[4];
-                for (auto& v : f.v) {
-                    x[i] = v.x;
-                    y[i] = v.y;
-                    ++i;
-                }
-                retaBresenhan(x[0], y[0], x[1], y[1]);
-                retaBresenhan(x[1], y[1], x[2], y[2]);
-                retaBresenhan(x[2], y[2], x[3], y[3]);
-                retaBresenhan(x[3], y[3], x[0], y[0]);
-                break;
+
+    // Durante o arrasto da selecao, desenha o retangulo de selecao
+    int vermelho[3] = {255, 0, 0};
+    if (arrastando && modo == SEL) desenharRetangulo(x_1, y_1, m_x, m_y, vermelho);
+}
+
+/*
+ * Funcao que reune, sem repeticao, as formas dos ladrilhos visiveis que de fato cruzam a janela
+ */
+void coletarVisiveis(std::pmr::vector<forma*>& visiveis) {
+    // Regiao do canvas visivel na janela
+    int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+    int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+    int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+
+    percorrerLadrilhos(vxMin, vyMin, vxMax, vyMax, [&](ladrilho& t, int, int) {
+        for (const auto& e : t.formas) {
+            forma* f = e.f;
+            if (f->xMax >= vxMin && f->xMin <= vxMax && f->yMax >= vyMin && f->yMin <= vyMax) {
+                visiveis.push_back(f);
             }
-            // Desenha triangulo 
-            case TRI: {
-                int i = 0, x[3], y[3];
-                for (auto& v : f.v) {
-                    x[i] = v.x;
-                    y[i] = v.y;
-                    ++i;
-                }
-                retaBresenhan(x[0], y[0], x[1], y[1]);
-                retaBresenhan(x[1], y[1], x[2], y[2]);
-                retaBresenhan(x[2], y[2], x[0], y[0]);
-                break;  
-            }
-            // Desenha poligono com 4+ vertices
-            case POL: {
-                int prev_x = -1, prev_y = -1;
-                for (auto& v : f.v) {
-                    if (prev_x != -1 && prev_y != -1) {
-                        retaBresenhan(prev_x, prev_y, v.x, v.y);
-                    }
-                    prev_x = v.x;
-                    prev_y = v.y;
-                }
-                // Connect the last vertex to the first to close the polygon
-                if (!f.v.empty()) {
-                    retaBresenhan(prev_x, prev_y, f.v.front().x, f.v.front().y);
-                }
-                break;
+        }
+    });
+
+    // Uma forma pode tocar varios ladrilhos
+    std::sort(visiveis.begin(), visiveis.end());
+    visiveis.erase(std::unique(visiveis.begin(), visiveis.end()), visiveis.end());
+}
+
+/*
+ * Funcao que desenha o contorno e o preenchimento de uma forma, ladrilho a ladrilho
+ */
+void desenharForma(const forma& f) {
+    for (size_t i = 0; i < f.chaves.size(); ++i) {
+        int tx, ty;
+        coordenadasLadrilho(f.chaves[i], tx, ty);
+        recorteLadrilho r = recorteDe(f, (*f.pedacos)[i].get(), tx, ty);
+        desenharRecorte(f, r, 0, r.total());
+    }
+}
+
+/*
+ * Funcao que desenha as faixas ini..fim-1 do recorte de uma forma em um ladrilho:
+ * as do contorno em preto e as do preenchimento com a cor ou o estilo da forma
+ */
+void desenharRecorte(const forma& f, const recorteLadrilho& r, size_t ini, size_t fim) {
+    int y, xIni, xFim;
+    size_t i = ini;
+    for (; i < std::min(fim, r.nContorno); ++i) {
+        if (faixaDoRecorte(r, i, y, xIni, xFim)) drawFaixa(y, xIni, xFim, preto);
+    }
+
+    // Desenha as faixas preenchidas
+    int cor[3] = {f.cor[0], f.cor[1], f.cor[2]};
+    if (f.estilo == SOLIDO) {
+        for (; i < fim; ++i) {
+            if (faixaDoRecorte(r, i, y, xIni, xFim)) drawFaixa(y, xIni, xFim, cor);
+        }
+    } else if (f.preenchido && i < fim) {
+        // Os demais estilos sao avaliados faixa a faixa em uma imagem RGBA da parte
+        // visivel do recorte, enviada de uma vez com glDrawPixels; os pixels fora das
+        // faixas ficam transparentes e sao descartados pelo teste de alfa
+        int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+        int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+        int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+        // Retangulo envolvente das faixas visiveis, que cabe em um ladrilho
+        int xMin = INT_MAX, xMax = INT_MIN, yMin = INT_MAX, yMax = INT_MIN;
+        for (size_t k = i; k < fim; ++k) {
+            if (!faixaDoRecorte(r, k, y, xIni, xFim) || y < vyMin || y > vyMax) continue;
+            xIni = std::max(xIni, vxMin);
+            xFim = std::min(xFim, vxMax);
+            if (xIni > xFim) continue;
+            xMin = std::min(xMin, xIni);
+            xMax = std::max(xMax, xFim);
+            yMin = std::min(yMin, y);
+            yMax = std::max(yMax, y);
+        }
+        if (xMin > xMax) return;
+        int w = xMax - xMin + 1, h = yMax - yMin + 1;
+        escopoRascunho escopo;
+        std::pmr::vector<uint32_t> imagem(static_cast<size_t>(w) * h, 0, escopo.recurso());
+        for (; i < fim; ++i) {
+            if (!faixaDoRecorte(r, i, y, xIni, xFim) || y < vyMin || y > vyMax) continue;
+            xIni = std::max(xIni, vxMin);
+            xFim = std::min(xFim, vxMax);
+            if (xIni > xFim) continue;
+            avaliarFaixa(f, y, xIni, xFim, imagem.data() + static_cast<size_t>(y - yMin) * w + (xIni - xMin));
+        }
+        // A posicao de raster parte do centro da janela, que e sempre valida, e e
+        // deslocada em pixels da janela com glBitmap ate o canto da imagem
+        double centroX = camX + width / (2 * zoom), centroY = camY + height / (2 * zoom);
+        glRasterPos2d(centroX, centroY);
+        glBitmap(0, 0, 0, 0, static_cast<float>((xMin - centroX) * zoom), static_cast<float>((yMin - centroY) * zoom), nullptr);
+        glEnable(GL_ALPHA_TEST);
+        glAlphaFunc(GL_GREATER, 0);
+        glDrawPixels(w, h, GL_RGBA, GL_UNSIGNED_BYTE, imagem.data());
+        glDisable(GL_ALPHA_TEST);
+    }
+}
+
+/*
+ * Funcao que destaca as formas selecionadas com o retangulo envolvente de cada uma
+ * que aparece na janela; selecoes grandes recebem um unico retangulo envolvendo todas
+ */
+const size_t MAXIMO_RETANGULOS_SELECAO = 256;
+
+void desenharSelecao() {
+    if (selecao.empty()) return;
+    int vermelho[3] = {255, 0, 0};
+    if (selecao.size() > MAXIMO_RETANGULOS_SELECAO) {
+        int xMin = INT_MAX, yMin = INT_MAX, xMax = INT_MIN, yMax = INT_MIN;
+        for (const forma* f : selecao) {
+            xMin = std::min(xMin, f->xMin);
+            yMin = std::min(yMin, f->yMin);
+            xMax = std::max(xMax, f->xMax);
+            yMax = std::max(yMax, f->yMax);
+        }
+        desenharRetangulo(xMin - 1, yMin - 1, xMax + 1, yMax + 1, vermelho);
+        return;
+    }
+    int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+    int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+    int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+    for (const forma* f : selecao) {
+        if (f->xMax + 1 < vxMin || f->xMin - 1 > vxMax || f->yMax + 1 < vyMin || f->yMin - 1 > vyMax) continue;
+        desenharRetangulo(f->xMin - 1, f->yMin - 1, f->xMax + 1, f->yMax + 1, vermelho);
+    }
+}
+
+/*
+ * Funcao que desenha o contorno de um retangulo alinhado aos eixos
+ */
+void desenharRetangulo(int x1, int y1, int x2, int y2, int cor[3]) {
+    drawFaixa(y1, std::min(x1, x2), std::max(x1, x2), cor);
+    drawFaixa(y2, std::min(x1, x2), std::max(x1, x2), cor);
+    glRecti(x1, std::min(y1, y2), x1 + 1, std::max(y1, y2) + 1);
+    glRecti(x2, std::min(y1, y2), x2 + 1, std::max(y1, y2) + 1);
+}
+
+/*
+ * Funcao que rasteriza o contorno de uma forma, entregando cada trecho horizontal
+ * de pixels a faixa(y, xIni, xFim)
+ */
+template <typename P>
+void rasterizarContorno(const forma& f, P faixa) {
+    switch (f.tipo) {
+        // Linha
+        case LIN: {
+            int i = 0, x[2], y[2];
+            // Percorre a lista de vertices da forma linha
+            for (auto& v : f.v) {
+                x[i] = v.x;
+                y[i] = v.y;
+                ++i;
+            }
+            rasterizarReta(x[0], y[0], x[1], y[1], faixa);
+            break;
+        }
+        // Quadrilatero com 2 pontos
+        case QUAD: {
+            int i = 0, x[4], y[4];
+            for (auto& v : f.v) {
+                x[i] = v.x;
+                y[i] = v.y;
+                ++i;
+            }
+            rasterizarReta(x[0], y[0], x[1], y[1], faixa);
+            rasterizarReta(x[1], y[1], x[2], y[2], faixa);
+            rasterizarReta(x[2], y[2], x[3], y[3], faixa);
+            rasterizarReta(x[3], y[3], x[0], y[0], faixa);
+            break;
+        }
+        // Triangulo
+        case TRI: {
+            int i = 0, x[3], y[3];
+            for (auto& v : f.v) {
+                x[i] = v.x;
+                y[i] = v.y;
+                ++i;
             }
-            // Desenha circunferencia
-            case CIR: {
-                int i = 0, x[2], y[2];
-                for (auto& v : f.v) {
-                    x[i] = v.x;
-                    y[i] = v.y;
-                    ++i;
+            rasterizarReta(x[0], y[0], x[1], y[1], faixa);
+            rasterizarReta(x[1], y[1], x[2], y[2], faixa);
+            rasterizarReta(x[2], y[2], x[0], y[0], faixa);
+            break;
+        }
+        // Poligono com 4+ vertices
+        case POL: {
+            const vertice* anterior = nullptr;
+            for (auto& v : f.v) {
+                if (anterior) {
+                    rasterizarReta(anterior->x, anterior->y, v.x, v.y, faixa);
                 }
-                int raio = x[0];
-                circuloBresenhan(x[1], y[1], raio);
-                break;
+                anterior = &v;
             }
+            // Liga o ultimo vertice ao primeiro para fechar o poligono
+            if (anterior) {
+                rasterizarReta(anterior->x, anterior->y, f.v.front().x, f.v.front().y, faixa);
+            }
+            break;
         }
-
-        // Desenha os pontos preenchidos
-        int cor[3] = {f.cor[0], f.cor[1], f.cor[2]};
-        for (const auto& p : f.preenchidos) {
-            drawPixel(p.x, p.y, cor);
+        // Circunferencia: o raio e o primeiro vertice e o centro e o segundo
+        case CIR: {
+            int raio = f.v.front().x;
+            const vertice& centro = *std::next(f.v.begin());
+            rasterizarCirculo(centro.x, centro.y, raio, faixa);
+            break;
+        }
+        // Instancia: contorno do raster da definicao, deslocado
+        case INST: {
+            if (!f.raster) break;
+            int dx = std::lround(f.matriz[0][2]), dy = std::lround(f.matriz[1][2]);
+            for (const auto& fx : f.raster->contorno) faixa(fx.y + dy, fx.xIni + dx, fx.xFim + dx);
+            break;
         }
     }
 }
@@ -733,77 +1700,110 @@ void drawFormas() {
 * Funcao que implementa Algoritmo de Bresenhan na rasterização de uma reta
 */
 void retaBresenhan(int x1, int y1, int x2, int y2) {
-        int x, y;
-        bool declive = false, simetrico = false;
-        int deltaX, deltaY;
-        deltaX = x2 - x1;
-        deltaY = y2 - y1;
-        if ((deltaX * deltaY) < 0) {
-            y1 *= -1;
-            y2 *= -1;
-            deltaY *= -1;
-            simetrico = true;
-        }
-        if (abs(deltaX) < abs(deltaY)) {
-            swap(x1, y1);
-            swap(x2, y2);
-            swap(deltaX, deltaY);
-            declive = true;
+    rasterizarReta(x1, y1, x2, y2, [](int y, int xIni, int xFim) { drawFaixa(y, xIni, xFim, preto); });
+}
+
+/*
+* Núcleo de Bresenhan para retas quase horizontais (|deltaX| >= |deltaY|)
+* Percorre x de x1 a x2 (x1 <= x2) com y andando PassoY a cada passo diagonal,
+* e emite cada trecho de mesmo y como uma única faixa
+*/
+template <int PassoY, typename P>
+void retaQuaseHorizontal(int x1, int y1, int x2, int deltaX, int deltaY, P faixa) {
+    int d = 2*deltaY - deltaX;
+    int incE = 2*deltaY;
+    int incNE = 2*(deltaY - deltaX);
+    int y = y1, inicio = x1;
+    for (int x = x1; x < x2; ++x) {
+        if (d <= 0) {
+            d += incE;
+        } else {
+            d += incNE;
+            faixa(y, inicio, x);
+            y += PassoY;
+            inicio = x + 1;
         }
+    }
+    faixa(y, inicio, x2);
+}
+
+/*
+* Núcleo de Bresenhan para retas quase verticais (|deltaY| > |deltaX|)
+* Percorre y de y1 a y2 em passos PassoY com x crescente, um pixel por linha
+*/
+template <int PassoY, typename P>
+void retaQuaseVertical(int x1, int y1, int y2, int deltaX, int deltaY, P faixa) {
+    int d = 2*deltaX - deltaY;
+    int incE = 2*deltaX;
+    int incNE = 2*(deltaX - deltaY);
+    int x = x1;
+    for (int y = y1; y != y2; y += PassoY) {
+        faixa(y, x, x);
+        if (d <= 0) {
+            d += incE;
+        } else {
+            d += incNE;
+            x++;
+        }
+    }
+    faixa(y2, x, x);
+}
+
+/*
+* Funcao que escolhe o núcleo especializado do octante da reta
+* Produz os mesmos pixels da normalização por simetria e troca de eixos
+*/
+template <typename P>
+void rasterizarReta(int x1, int y1, int x2, int y2, P faixa) {
+    int deltaX = abs(x2 - x1), deltaY = abs(y2 - y1);
+    if (deltaX >= deltaY) {
+        // Começa pela extremidade de menor x
         if (x1 > x2) {
             swap(x1, x2);
             swap(y1, y2);
-            deltaX *= -1;
-            deltaY *= -1;
-        }
-        
-        int d, incE, incNE;
-        d = 2*deltaY - deltaX;
-        incE = 2*deltaY;
-        incNE = 2*(deltaY - deltaX);
-        x = x1; y = y1;
-        
-        while (x <= x2) {
-            int xi = x, yi = y;
-            if (declive) swap(xi, yi);
-            if (simetrico) yi *= -1;
-            if (d <= 0) {
-                d += incE;
-            } else {
-                d += incNE;
-                y++;
-            }
-            x++;
-            
-            drawPixel(xi, yi, preto);
         }
+        if (y2 >= y1) retaQuaseHorizontal<1>(x1, y1, x2, deltaX, deltaY, faixa);
+        else retaQuaseHorizontal<-1>(x1, y1, x2, deltaX, deltaY, faixa);
+    } else {
+        // Começa pela extremidade de menor x (ou de menor y, se a reta for vertical)
+        if (x1 > x2 || (x1 == x2 && y1 > y2)) {
+            swap(x1, x2);
+            swap(y1, y2);
+        }
+        if (y2 > y1) retaQuaseVertical<1>(x1, y1, y2, deltaX, deltaY, faixa);
+        else retaQuaseVertical<-1>(x1, y1, y2, deltaX, deltaY, faixa);
+    }
 }
 
 /*
 * Função para desenhar um círculo utilizando o algoritmo de Bresenhan
 */
 void circuloBresenhan(int x, int y, int raio) {
+    rasterizarCirculo(x, y, raio, [](int py, int xIni, int xFim) { drawFaixa(py, xIni, xFim, preto); });
+}
+
+template <typename P>
+void rasterizarCirculo(int x, int y, int raio, P faixa) {
     // Translada o centro do círculo para a origem
     int cx = x, cy = y, d, incE, incSE;
     x = 0;
     y = raio;
 
-    // Cria um vetor para armazenar os pixels ao redor do centroide e só depois desenha na tela
-    std::vector<std::pair<int, int>> pixels;
 
     d = 1 - raio;
     incE = 3;
     incSE = -2 * raio + 5;
 
     while (x <= y) {
-        pixels.push_back({x, y});
-        pixels.push_back({y, x});
-        pixels.push_back({-x, y});
-        pixels.push_back({-y, x});
-        pixels.push_back({-x, -y});
-        pixels.push_back({-y, -x});
-        pixels.push_back({x, -y});
-        pixels.push_back({y, -x});
+        // Os oito pontos simétricos ao redor do centro
+        faixa(cy + y, cx + x, cx + x);
+        faixa(cy + x, cx + y, cx + y);
+        faixa(cy + y, cx - x, cx - x);
+        faixa(cy + x, cx - y, cx - y);
+        faixa(cy - y, cx - x, cx - x);
+        faixa(cy - x, cx - y, cx - y);
+        faixa(cy - y, cx + x, cx + x);
+        faixa(cy - x, cx + y, cx + y);
 
         if (d < 0) {
             d += incE;
@@ -817,11 +1817,56 @@ void circuloBresenhan(int x, int y, int raio) {
         }
         x++;
     }
+}
 
-    for (const auto& pixel : pixels) {
-        drawPixel(cx + pixel.first, cy + pixel.second, preto);
+/*
+* Função que percorre as linhas de um disco de raio dado
+* Usa a mesma recorrência do ponto médio de circuloBresenhan e chama
+* emitir(dy, meiaLargura) exatamente uma vez para cada dy em [-raio, raio]
+*/
+template <typename F>
+void faixasCirculo(int raio, F emitir) {
+    int x = 0, y = raio, d = 1 - raio, incE = 3, incSE = -2 * raio + 5;
+    while (x <= y) {
+        // Linhas +- x têm meia largura y, e cada x é visitado uma única vez
+        emitir(x, y);
+        if (x != 0) emitir(-x, y);
+
+        if (d < 0) {
+            d += incE;
+            incE += 2;
+            incSE += 2;
+        } else {
+            // y vai mudar: a faixa das linhas +- y atingiu a largura final
+            if (x != y) {
+                emitir(y, x);
+                emitir(-y, x);
+            }
+            d += incSE;
+            incE += 2;
+            incSE += 4;
+            y--;
+        }
+        x++;
     }
-    
+}
+
+/*
+* Função para preencher um círculo com faixas horizontais
+* Emite uma única faixa por linha do disco, sem leitura de pixels da tela
+*/
+void preencherCirculo(forma& f) {
+    // O raio é o primeiro vértice e o centro é o segundo
+    int raio = f.v.front().x;
+    int cx = std::next(f.v.begin())->x;
+    int cy = std::next(f.v.begin())->y;
+
+    f.preenchido = true;
+
+    std::vector<faixa>& faixas = abrirFaixas(f);
+    faixasCirculo(raio, [&](int dy, int meia) {
+        faixas.push_back({cy + dy, cx - meia, cx + meia});
+    });
 }
 
 /*
@@ -830,6 +1875,7 @@ Função para preencher um polígono
 void preencherPoligono(forma& f) {
     // Marca poligono como preenchido
     f.preenchido = true;
+    std::vector<faixa>& faixas = abrirFaixas(f);
     
     // Cria Tabela de Arestas (TA), Tabela de Arestas Ativas (TAA) e Span Buffer
     struct Aresta {
@@ -837,11 +1883,17 @@ void preencherPoligono(forma& f) {
         float xMin;
         float inversoDeclive;
     };
-    std::vector<std::vector<Aresta>> TA(height);
-    std::vector<Aresta> TAA;
+    // A TA cobre apenas as linhas ocupadas pelo polígono, indexada por y - ymin
+    escopoRascunho escopo;
+    int ymin = f.v.front().y, ymax = f.v.front().y;
+    for (const auto& vert : f.v) {
+        ymin = std::min(ymin, vert.y);
+        ymax = std::max(ymax, vert.y);
+    }
+    std::pmr::vector<std::pmr::vector<Aresta>> TA(ymax - ymin + 1, escopo.recurso());
+    std::pmr::vector<Aresta> TAA(escopo.recurso());
 
     // Preenche a Tabela de Arestas
-    int ymin = height;
     for (auto verticeAtual = f.v.begin(); verticeAtual != f.v.end(); ++verticeAtual) {
         auto proximoVertice = std::next(verticeAtual);
         if (proximoVertice == f.v.end()) {
@@ -863,24 +1915,19 @@ void preencherPoligono(forma& f) {
         aresta.xMin = x1;
         aresta.inversoDeclive = static_cast<float>(x2 - x1) / (y2 - y1);
 
-        if (y1 < height) {
-            TA[y1].push_back(aresta);
-        }
-        ymin = std::min(ymin, y1);
+        TA[y1 - ymin].push_back(aresta);
     }
 
     // Inicializa y como o valor da menor ordenada de todos os vértices do polígono
     int y = ymin;
 
     // Repetir até que tanto a TA como a TAA fiquem vazias
-    while (y < height && (!TA[y].empty() || !TAA.empty())) {
+    while (y <= ymax && (!TA[y - ymin].empty() || !TAA.empty())) {
         // Mover da TA para a TAA as arestas para as quais y = ymin
-        if (y < TA.size()) {
-            for (const auto& aresta : TA[y]) {
-                TAA.push_back(aresta);
-            }
-            TA[y].clear();
+        for (const auto& aresta : TA[y - ymin]) {
+            TAA.push_back(aresta);
         }
+        TA[y - ymin].clear();
 
         // Ordenar a TAA pelo x(ymin)
         std::sort(TAA.begin(), TAA.end(), [](const Aresta& a, const Aresta& b) {
@@ -891,10 +1938,8 @@ void preencherPoligono(forma& f) {
         for (size_t i = 0; i + 1 < TAA.size(); i += 2) {
             int xStart = static_cast<int>(TAA[i].xMin);
             int xEnd = static_cast<int>(TAA[i + 1].xMin);
-            for (int x = xStart; x <= xEnd; ++x) {
-                if (y < height) {
-                    f.preenchidos.push_front({x, y});
-                }
+            if (xStart <= xEnd) {
+                faixas.push_back({y, xStart, xEnd});
             }
         }
 
@@ -911,86 +1956,99 @@ void preencherPoligono(forma& f) {
             aresta.xMin += aresta.inversoDeclive;
         }
     }
-}
-
-// Função para ler a cor de um pixel na janela GLUT
-void lerCorPixel(int x, int y, unsigned char* cor) {
-    if (x < 0 || x >= width || y < 0 || y >= height) {
-        // Coordenadas fora dos limites da janela
-        cor[0] = cor[1] = cor[2] = 0;
-        return;
-    }
-    glReadPixels(x, y, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, cor);
-}
 
-// Função para comparar duas cores
-bool coresIguais(unsigned char* cor1, unsigned char* cor2) {
-    return cor1[0] == cor2[0] && cor1[1] == cor2[1] && cor1[2] == cor2[2];
+    registrarPico(picoPreencherPoligono, escopo.ocupado());
 }
 
+// Função para preencher a região livre do canvas que contém (x, y)
+// A fronteira é lida de máscaras de bits rasterizadas sob demanda a partir dos
+// ladrilhos, sem leitura da tela, e o preenchimento fica contido no retângulo
+// envolvente da cena acrescido de uma borda de um pixel
+void floodFill(int x, int y, forma& f) {
+    // Limites da cena
+    int lxMin = INT_MAX, lyMin = INT_MAX, lxMax = INT_MIN, lyMax = INT_MIN;
+    for (const auto& g : formas) {
+        if (g.xMin > g.xMax) continue;
+        lxMin = std::min(lxMin, g.xMin - 1);
+        lyMin = std::min(lyMin, g.yMin - 1);
+        lxMax = std::max(lxMax, g.xMax + 1);
+        lyMax = std::max(lyMax, g.yMax + 1);
+    }
+    if (x < lxMin || x > lxMax || y < lyMin || y > lyMax) return;
 
-void floodFill(int x, int y, unsigned char* novaCor, forma& f) {
-    unsigned char corAlvo[3];
-    lerCorPixel(x, y, corAlvo);
+    // Máscaras dos ladrilhos tocados por este preenchimento, descartadas ao final
+    escopoRascunho escopo;
+    std::pmr::unordered_map<long long, std::pmr::vector<uint64_t>> mascaras(escopo.recurso());
+    long long chaveAtual = 0;
+    std::pmr::vector<uint64_t>* mascaraAtual = nullptr;
+    auto mascaraDe = [&](int px, int py) -> std::pmr::vector<uint64_t>& {
+        int tx = ladrilhoDe(px), ty = ladrilhoDe(py);
+        long long chave = chaveLadrilho(tx, ty);
+        if (mascaraAtual && chave == chaveAtual) return *mascaraAtual;
+        auto inserido = mascaras.try_emplace(chave);
+        if (inserido.second) rasterizarMascara(tx, ty, inserido.first->second);
+        chaveAtual = chave;
+        mascaraAtual = &inserido.first->second;
+        return *mascaraAtual;
+    };
+    auto indiceBit = [](int px, int py) {
+        int lx = px - ladrilhoDe(px) * LADO_LADRILHO, ly = py - ladrilhoDe(py) * LADO_LADRILHO;
+        return ly * LADO_LADRILHO + lx;
+    };
+    auto ocupado = [&](int px, int py) {
+        int i = indiceBit(px, py);
+        return (mascaraDe(px, py)[i >> 6] >> (i & 63)) & 1;
+    };
+    auto marcar = [&](int px, int py) {
+        int i = indiceBit(px, py);
+        mascaraDe(px, py)[i >> 6] |= uint64_t(1) << (i & 63);
+    };
 
-    if (coresIguais(corAlvo, novaCor)) return;
+    if (ocupado(x, y)) return;
+    std::vector<faixa>& faixas = abrirFaixas(f);
 
-    // Marca os pixels visitados
-    std::vector<std::vector<bool>> visitado(height, std::vector<bool>(width, false));
-    
     // Fila para expansão
-    std::queue<std::pair<int, int>> fila;
+    std::queue<std::pair<int, int>, std::pmr::deque<std::pair<int, int>>> fila(std::pmr::polymorphic_allocator<std::pair<int, int>>(escopo.recurso()));
     fila.push({x, y});
-    visitado[y][x] = true;
 
     while (!fila.empty()) {
         int cx = fila.front().first;
         int cy = fila.front().second;
         fila.pop();
 
-        unsigned char corAtual[3];
+        // O mesmo pixel pode ter entrado na fila mais de uma vez
+        if (ocupado(cx, cy)) continue;
 
         // Varredura horizontal para encontrar os limites
         int esquerda = cx;
         int direita = cx;
 
         // Procura para a esquerda
-        while (esquerda > 0) {
-            lerCorPixel(esquerda - 1, cy, corAtual);
-            if (!coresIguais(corAtual, corAlvo)) break;
-            esquerda--;
-        }
+        while (esquerda > lxMin && !ocupado(esquerda - 1, cy)) esquerda--;
 
         // Procura para a direita
-        while (direita < width - 1) {
-            lerCorPixel(direita + 1, cy, corAtual);
-            if (!coresIguais(corAtual, corAlvo)) break;
-            direita++;
-        }
+        while (direita < lxMax && !ocupado(direita + 1, cy)) direita++;
 
-        // Desenha e processa os pixels entre `esquerda` e `direita`
+        // Marca os pixels entre `esquerda` e `direita`, que passam a ser fronteira,
+        // e guarda o trecho como uma faixa da forma
         for (int nx = esquerda; nx <= direita; nx++) {
-            int corInt[3] = {novaCor[0], novaCor[1], novaCor[2]};
-            drawPixel(nx, cy, corInt);
-            f.preenchidos.push_front({nx, cy, {novaCor[0], novaCor[1], novaCor[2]}});
-
-            // Adiciona os vizinhos verticais à fila
-            if (cy > 0 && !visitado[cy-1][nx]) {
-                lerCorPixel(nx, cy-1, corAtual);
-                if (coresIguais(corAtual, corAlvo)) {
-                    fila.push({nx, cy-1});
-                    visitado[cy-1][nx] = true;
-                }
-            }
-            if (cy < height - 1 && !visitado[cy+1][nx]) {
-                lerCorPixel(nx, cy+1, corAtual);
-                if (coresIguais(corAtual, corAlvo)) {
-                    fila.push({nx, cy+1});
-                    visitado[cy+1][nx] = true;
-                }
+            marcar(nx, cy);
+        }
+        faixas.push_back({cy, esquerda, direita});
+
+        // Adiciona à fila um pixel de cada trecho livre das linhas vizinhas
+        for (int ny : {cy - 1, cy + 1}) {
+            if (ny < lyMin || ny > lyMax) continue;
+            bool livreAnterior = false;
+            for (int nx = esquerda; nx <= direita; nx++) {
+                bool livre = !ocupado(nx, ny);
+                if (livre && !livreAnterior) fila.push({nx, ny});
+                livreAnterior = livre;
             }
         }
     }
+
+    registrarPico(picoFloodFill, escopo.ocupado());
 }
 
 
@@ -1000,29 +2058,2633 @@ void preencherTodasFormas() {
     unsigned char corNova[3] = {0, 0, 255}; // Azul
 
     for (auto& f : formas) {
-        if (f.preenchido || f.tipo == LIN) {
+        if (f.preenchido || f.tipo == LIN || f.tipo == INST) {
             continue;
         }
         else if (f.tipo == CIR) {
-            // O centro do circulo é o segundo vértice
-            int i = 0, x[2], y[2];
-            for (auto& v : f.v) {
-                x[i] = v.x;
-                y[i] = v.y;
-                ++i;
-            }
-            floodFill(x[1], y[1], corNova, f);
-            f.preenchido = true; 
+            // Círculos são preenchidos diretamente por faixas, sem flood fill
+            f.estilo = estiloAtual;
+            preencherCirculo(f);
             f.cor[0] = corNova[0];
             f.cor[1] = corNova[1];
             f.cor[2] = corNova[2];
         } else {
             vertice centroide = calcularCentroide(f);
-            floodFill(centroide.x, centroide.y, corNova, f);
+            f.estilo = estiloAtual;
+            floodFill(centroide.x, centroide.y, f);
             f.preenchido = true; // Marca a forma como preenchida
             f.cor[0] = corNova[0];
             f.cor[1] = corNova[1];
             f.cor[2] = corNova[2];
         }
+        // Os próximos preenchimentos enxergam este como fronteira
+        indexarForma(f);
+    }
+}
+
+// Função para preencher todas as formas não preenchidas em uma única varredura
+// Uma Tabela de Arestas global reúne as arestas de todos os polígonos, triângulos,
+// quadriláteros e círculos, e cada aresta da TAA carrega o id da forma a que pertence.
+// Assim cada linha de varredura é visitada uma única vez para a cena inteira
+void preencherCena() {
+    int corNova[3] = {0, 0, 255}; // Azul
+
+    struct ArestaCena {
+        int id;               // índice da forma em alvo
+        int yMax;
+        float x;
+        float inversoDeclive;
+        int circulo = -1;     // índice em circulos, ou -1 para arestas de polígono
+        int lado = 0;         // -1 borda esquerda e +1 borda direita do círculo
+    };
+    struct Circulo {
+        int cx, cy;
+        std::pmr::vector<int> meia; // meia largura de cada linha, indexada por dy + raio
+    };
+
+    // Seleciona as formas a preencher e a faixa de linhas ocupada pela cena
+    escopoRascunho escopo;
+    std::pmr::vector<forma*> alvo(escopo.recurso());
+    std::pmr::vector<Circulo> circulos(escopo.recurso());
+    int yMin = 0, yMax = -1;
+    for (auto& f : formas) {
+        if (f.preenchido || f.tipo == LIN || f.tipo == INST) continue;
+        int fyMin, fyMax;
+        if (f.tipo == CIR) {
+            int raio = f.v.front().x;
+            int cy = std::next(f.v.begin())->y;
+            fyMin = cy - raio;
+            fyMax = cy + raio;
+        } else {
+            fyMin = fyMax = f.v.front().y;
+            for (const auto& vert : f.v) {
+                fyMin = std::min(fyMin, vert.y);
+                fyMax = std::max(fyMax, vert.y);
+            }
+        }
+        if (alvo.empty()) {
+            yMin = fyMin;
+            yMax = fyMax;
+        } else {
+            yMin = std::min(yMin, fyMin);
+            yMax = std::max(yMax, fyMax);
+        }
+        abrirFaixas(f);
+        alvo.push_back(&f);
+    }
+    if (alvo.empty()) return;
+
+    // Preenche a Tabela de Arestas global, indexada por y - yMin
+    std::pmr::vector<std::pmr::vector<ArestaCena>> TA(yMax - yMin + 1, escopo.recurso());
+    for (int id = 0; id < static_cast<int>(alvo.size()); ++id) {
+        forma& f = *alvo[id];
+        if (f.tipo == CIR) {
+            // O círculo entra como um par de bordas cuja abscissa vem da tabela de meias larguras
+            int raio = f.v.front().x;
+            int cy = std::next(f.v.begin())->y;
+            Circulo c{std::next(f.v.begin())->x, cy, std::pmr::vector<int>(2 * raio + 1, escopo.recurso())};
+            faixasCirculo(raio, [&](int dy, int meia) { c.meia[dy + raio] = meia; });
+            circulos.push_back(std::move(c));
+
+            int indice = static_cast<int>(circulos.size()) - 1;
+            TA[cy - raio - yMin].push_back({id, cy + raio + 1, 0, 0, indice, -1});
+            TA[cy - raio - yMin].push_back({id, cy + raio + 1, 0, 0, indice, 1});
+            continue;
+        }
+        for (auto verticeAtual = f.v.begin(); verticeAtual != f.v.end(); ++verticeAtual) {
+            auto proximoVertice = std::next(verticeAtual);
+            if (proximoVertice == f.v.end()) {
+                proximoVertice = f.v.begin();
+            }
+
+            int y1 = verticeAtual->y, y2 = proximoVertice->y;
+            int x1 = verticeAtual->x, x2 = proximoVertice->x;
+
+            if (y1 == y2) continue; // Ignora arestas horizontais
+
+            if (y1 > y2) {
+                std::swap(y1, y2);
+                std::swap(x1, x2);
+            }
+
+            TA[y1 - yMin].push_back({id, y2, static_cast<float>(x1), static_cast<float>(x2 - x1) / (y2 - y1)});
+        }
+    }
+
+    auto menor = [](const ArestaCena& a, const ArestaCena& b) {
+        return a.id != b.id ? a.id < b.id : a.x < b.x;
+    };
+
+    // Varredura única de baixo para cima
+    std::pmr::vector<ArestaCena> TAA(escopo.recurso()), mescla(escopo.recurso());
+    for (int y = yMin; y <= yMax; ++y) {
+        // As bordas dos círculos são lidas da tabela da linha corrente
+        auto& entrada = TA[y - yMin];
+        for (auto& aresta : entrada) {
+            if (aresta.circulo >= 0) {
+                const Circulo& c = circulos[aresta.circulo];
+                aresta.x = static_cast<float>(c.cx + aresta.lado * c.meia[y - c.cy + c.meia.size() / 2]);
+            }
+        }
+        for (auto& aresta : TAA) {
+            if (aresta.circulo >= 0) {
+                const Circulo& c = circulos[aresta.circulo];
+                aresta.x = static_cast<float>(c.cx + aresta.lado * c.meia[y - c.cy + c.meia.size() / 2]);
+            }
+        }
+
+        // A TAA é mantida ordenada pela forma e, dentro de cada forma, por x.
+        // Entre duas linhas a ordem só muda dentro de uma mesma forma, então a
+        // ordenação por inserção é linear, e as arestas novas entram por mescla
+        for (size_t i = 1; i < TAA.size(); ++i) {
+            ArestaCena aresta = TAA[i];
+            size_t j = i;
+            while (j > 0 && menor(aresta, TAA[j - 1])) {
+                TAA[j] = TAA[j - 1];
+                --j;
+            }
+            TAA[j] = aresta;
+        }
+        if (!entrada.empty()) {
+            std::sort(entrada.begin(), entrada.end(), menor);
+            mescla.clear();
+            std::merge(TAA.begin(), TAA.end(), entrada.begin(), entrada.end(), std::back_inserter(mescla), menor);
+            TAA.swap(mescla);
+            entrada.clear();
+        }
+        if (TAA.empty()) continue;
+
+        // Preencher os spans de cada forma, pareando as arestas de mesmo id
+        for (size_t i = 0; i + 1 < TAA.size(); ) {
+            if (TAA[i].id != TAA[i + 1].id) {
+                ++i;
+                continue;
+            }
+            int xStart = static_cast<int>(TAA[i].x);
+            int xEnd = static_cast<int>(TAA[i + 1].x);
+            if (xStart <= xEnd) {
+                alvo[TAA[i].id]->faixas.push_back({y, xStart, xEnd});
+            }
+            i += 2;
+        }
+
+        // Remover da TAA as arestas encerradas e avançar as demais
+        TAA.erase(std::remove_if(TAA.begin(), TAA.end(), [y](const ArestaCena& aresta) {
+            return y == aresta.yMax - 1;
+        }), TAA.end());
+        for (auto& aresta : TAA) {
+            aresta.x += aresta.inversoDeclive;
+        }
+    }
+
+    registrarPico(picoPreencherCena, escopo.ocupado());
+
+    for (forma* f : alvo) {
+        f->preenchido = true;
+        f->estilo = estiloAtual;
+        f->cor[0] = corNova[0];
+        f->cor[1] = corNova[1];
+        f->cor[2] = corNova[2];
+        indexarForma(*f);
+    }
+}
+
+/*
+ * Canvas esparso em ladrilhos
+ */
+
+// Função que devolve o ladrilho que contém a coordenada c do canvas (divisão com arredondamento para baixo)
+int ladrilhoDe(int c) {
+    return c >= 0 ? c / LADO_LADRILHO : -((-c - 1) / LADO_LADRILHO) - 1;
+}
+
+// Função que monta a chave de um ladrilho no mapa de ladrilhos
+long long chaveLadrilho(int tx, int ty) {
+    return (static_cast<long long>(tx) << 32) | static_cast<uint32_t>(ty);
+}
+
+// Função que separa a chave de um ladrilho nas suas coordenadas
+void coordenadasLadrilho(long long chave, int& tx, int& ty) {
+    tx = static_cast<int>(chave >> 32);
+    ty = static_cast<int>(static_cast<uint32_t>(chave));
+}
+
+// Função que visita os ladrilhos alocados que tocam o retângulo dado, como visitar(t, tx, ty)
+// Percorre a grade do retângulo ou o mapa de ladrilhos, o que for menor
+template <typename F>
+void percorrerLadrilhos(int xMin, int yMin, int xMax, int yMax, F visitar) {
+    int txMin = ladrilhoDe(xMin), tyMin = ladrilhoDe(yMin);
+    int txMax = ladrilhoDe(xMax), tyMax = ladrilhoDe(yMax);
+    long long area = static_cast<long long>(txMax - txMin + 1) * (tyMax - tyMin + 1);
+    if (area > static_cast<long long>(ladrilhos.size())) {
+        for (auto& par : ladrilhos) {
+            int tx, ty;
+            coordenadasLadrilho(par.first, tx, ty);
+            if (tx >= txMin && tx <= txMax && ty >= tyMin && ty <= tyMax) visitar(par.second, tx, ty);
+        }
+    } else {
+        for (int ty = tyMin; ty <= tyMax; ++ty) {
+            for (int tx = txMin; tx <= txMax; ++tx) {
+                auto it = ladrilhos.find(chaveLadrilho(tx, ty));
+                if (it != ladrilhos.end()) visitar(it->second, tx, ty);
+            }
+        }
+    }
+}
+
+// Função que monta o recorte de uma forma no ladrilho (tx, ty): o pedaco, ou, nas
+// instancias, as faixas do raster deslocado por dx, dy nas linhas do ladrilho
+// (o raster e ordenado por y, e as linhas sao achadas por busca binaria)
+recorteLadrilho recortarLadrilho(const pedacoForma* pedaco, const rasterDefinicao* raster, int dx, int dy, int tx, int ty) {
+    recorteLadrilho r;
+    r.xMin = tx * LADO_LADRILHO;
+    r.xMax = r.xMin + LADO_LADRILHO - 1;
+    if (pedaco) {
+        r.contorno = pedaco->faixas.data();
+        r.nContorno = pedaco->nContorno;
+        r.preenchimento = r.contorno + r.nContorno;
+        r.nPreenchimento = pedaco->faixas.size() - pedaco->nContorno;
+        return r;
+    }
+    if (!raster) return r;
+    r.dx = dx;
+    r.dy = dy;
+    int yIni = ty * LADO_LADRILHO - dy, yFim = yIni + LADO_LADRILHO - 1; // linhas do ladrilho no raster
+    auto linhas = [&](const std::vector<faixa>& faixas, const faixa*& inicio, size_t& n) {
+        auto antes = [](const faixa& fx, int y) { return fx.y < y; };
+        auto a = std::lower_bound(faixas.begin(), faixas.end(), yIni, antes);
+        auto b = std::lower_bound(a, faixas.end(), yFim + 1, antes);
+        inicio = faixas.data() + (a - faixas.begin());
+        n = b - a;
+    };
+    linhas(raster->contorno, r.contorno, r.nContorno);
+    linhas(raster->preenchimento, r.preenchimento, r.nPreenchimento);
+    return r;
+}
+
+// Função que monta o recorte de uma forma no ladrilho (tx, ty), dado o seu pedaco nele
+recorteLadrilho recorteDe(const forma& f, const pedacoForma* pedaco, int tx, int ty) {
+    if (f.tipo == INST) {
+        return recortarLadrilho(nullptr, f.raster.get(), std::lround(f.matriz[0][2]), std::lround(f.matriz[1][2]), tx, ty);
+    }
+    return recortarLadrilho(pedaco, nullptr, 0, 0, tx, ty);
+}
+
+// Função que le a faixa i do recorte, deslocada e recortada as colunas do ladrilho
+// Devolve false se nao sobra nenhum pixel
+bool faixaDoRecorte(const recorteLadrilho& r, size_t i, int& y, int& xIni, int& xFim) {
+    const faixa& fx = i < r.nContorno ? r.contorno[i] : r.preenchimento[i - r.nContorno];
+    y = fx.y + r.dy;
+    xIni = std::max(fx.xIni + r.dx, r.xMin);
+    xFim = std::min(fx.xFim + r.dx, r.xMax);
+    return xIni <= xFim;
+}
+
+// Função que reune em faixas o preenchimento guardado nos pedacos, ordenado por linha;
+// os trechos que os ladrilhos separaram voltam a ser uma faixa
+// Os pedacos sao imutaveis, e por isso pode rodar em qualquer thread
+void reunirFaixas(const listaPedacos* pedacos, std::vector<faixa>& faixas) {
+    faixas.clear();
+    if (!pedacos) return;
+    for (const auto& p : *pedacos) {
+        if (p) faixas.insert(faixas.end(), p->faixas.begin() + p->nContorno, p->faixas.end());
+    }
+    std::sort(faixas.begin(), faixas.end(), [](const faixa& a, const faixa& b) {
+        return a.y != b.y ? a.y < b.y : a.xIni < b.xIni;
+    });
+    size_t n = 0;
+    for (const faixa& fx : faixas) {
+        if (n > 0 && faixas[n - 1].y == fx.y && fx.xIni <= faixas[n - 1].xFim + 1) {
+            faixas[n - 1].xFim = std::max(faixas[n - 1].xFim, fx.xFim);
+        } else {
+            faixas[n++] = fx;
+        }
     }
+    faixas.resize(n);
+}
+
+// Função que abre as faixas preenchidas de uma forma para edicao, reunindo as dos
+// pedacos em f.faixas
+std::vector<faixa>& abrirFaixas(forma& f) {
+    if (f.faixasAbertas) return f.faixas;
+    reunirFaixas(f.pedacos.get(), f.faixas);
+    f.faixasAbertas = true;
+    return f.faixas;
 }
+
+// Função que percorre contorno e preenchimento de uma forma, atualizando seu retângulo
+// envolvente e devolvendo em chaves os ladrilhos tocados e em pedacos as faixas da forma
+// recortadas a cada um deles, sem alterar o mapa de ladrilhos
+// O contorno e rasterizado aqui, uma vez por alteracao, e o preenchimento vem de
+// f.faixas, se aberto, ou dos pedacos atuais; ao final f.faixas e esvaziado
+// Só toca a própria forma, e por isso pode rodar em paralelo para formas distintas
+void calcularIndice(forma& f, std::vector<long long>& chaves, listaPedacos& pedacos) {
+    chaves.clear();
+    pedacos.clear();
+    f.xMin = f.yMin = INT_MAX;
+    f.xMax = f.yMax = INT_MIN;
+    auto anotar = [&](int y, int xIni, int xFim) {
+        f.xMin = std::min(f.xMin, xIni);
+        f.yMin = std::min(f.yMin, y);
+        f.xMax = std::max(f.xMax, xFim);
+        f.yMax = std::max(f.yMax, y);
+    };
+    if (f.tipo == INST) {
+        // Instancias sao indexadas pelo retangulo envolvente do raster, sem percorrer as faixas
+        if (f.raster && f.raster->xMin <= f.raster->xMax) {
+            int dx = std::lround(f.matriz[0][2]), dy = std::lround(f.matriz[1][2]);
+            anotar(f.raster->yMin + dy, f.raster->xMin + dx, f.raster->xMax + dx);
+            anotar(f.raster->yMax + dy, f.raster->xMin + dx, f.raster->xMax + dx);
+            for (int ty = ladrilhoDe(f.yMin); ty <= ladrilhoDe(f.yMax); ++ty) {
+                for (int tx = ladrilhoDe(f.xMin); tx <= ladrilhoDe(f.xMax); ++tx) chaves.push_back(chaveLadrilho(tx, ty));
+            }
+            std::sort(chaves.begin(), chaves.end());
+            pedacos.resize(chaves.size());
+        }
+    } else {
+        // Cada faixa e cortada nas colunas dos ladrilhos, e os trechos sao agrupados por ladrilho
+        struct trecho{
+            long long chave;
+            bool contorno;
+            faixa fx;
+        };
+        escopoRascunho escopo;
+        std::pmr::vector<trecho> trechos(escopo.recurso());
+        auto repartir = [&](bool contorno, int y, int xIni, int xFim) {
+            anotar(y, xIni, xFim);
+            int ty = ladrilhoDe(y);
+            for (int tx = ladrilhoDe(xIni); tx <= ladrilhoDe(xFim); ++tx) {
+                trechos.push_back({chaveLadrilho(tx, ty), contorno,
+                                   {y, std::max(xIni, tx * LADO_LADRILHO), std::min(xFim, tx * LADO_LADRILHO + LADO_LADRILHO - 1)}});
+            }
+        };
+        rasterizarContorno(f, [&](int y, int xIni, int xFim) { repartir(true, y, xIni, xFim); });
+        if (f.faixasAbertas) {
+            for (const auto& fx : f.faixas) repartir(false, fx.y, fx.xIni, fx.xFim);
+        } else if (f.pedacos) {
+            for (const auto& p : *f.pedacos) {
+                if (!p) continue;
+                for (size_t i = p->nContorno; i < p->faixas.size(); ++i) {
+                    repartir(false, p->faixas[i].y, p->faixas[i].xIni, p->faixas[i].xFim);
+                }
+            }
+        }
+        std::sort(trechos.begin(), trechos.end(), [](const trecho& a, const trecho& b) {
+            return a.chave != b.chave ? a.chave < b.chave : a.contorno > b.contorno;
+        });
+        for (size_t ini = 0, fim; ini < trechos.size(); ini = fim) {
+            auto pedaco = std::make_shared<pedacoForma>();
+            for (fim = ini; fim < trechos.size() && trechos[fim].chave == trechos[ini].chave; ++fim) {
+                if (trechos[fim].contorno) ++pedaco->nContorno;
+            }
+            pedaco->faixas.reserve(fim - ini);
+            for (size_t i = ini; i < fim; ++i) pedaco->faixas.push_back(trechos[i].fx);
+            chaves.push_back(trechos[ini].chave);
+            pedacos.push_back(std::move(pedaco));
+        }
+        f.faixas.clear();
+        f.faixas.shrink_to_fit();
+        f.faixasAbertas = false;
+    }
+    if (chaves.empty()) {
+        f.xMin = f.yMin = 0;
+        f.xMax = f.yMax = -1;
+    }
+}
+
+// Função para atualizar o retângulo envolvente de uma forma e os ladrilhos em que ela aparece
+// Deve ser chamada sempre que os vértices ou o preenchimento da forma mudam
+void indexarForma(forma& f) {
+    f.editadaEm = ++versaoCena;
+    marcarSuja(f);
+
+    // Retira a forma dos ladrilhos antigos, liberando os que ficarem vazios
+    for (long long chave : f.chaves) {
+        auto it = ladrilhos.find(chave);
+        if (it == ladrilhos.end()) continue;
+        auto& lista = it->second.formas;
+        auto pos = std::find_if(lista.begin(), lista.end(), [&](const entradaLadrilho& e) { return e.f == &f; });
+        if (pos != lista.end()) {
+            *pos = std::move(lista.back());
+            lista.pop_back();
+            it->second.versao = versaoCena;
+        }
+        if (lista.empty()) ladrilhos.erase(it);
+    }
+
+    std::vector<long long> chaves;
+    listaPedacos pedacos;
+    calcularIndice(f, chaves, pedacos);
+    f.chaves.swap(chaves);
+    f.pedacos = std::make_shared<const listaPedacos>(std::move(pedacos));
+    for (size_t i = 0; i < f.chaves.size(); ++i) {
+        ladrilho& t = ladrilhos[f.chaves[i]];
+        t.formas.push_back({&f, (*f.pedacos)[i]});
+        t.versao = versaoCena;
+    }
+}
+
+// Função para reindexar de uma vez um conjunto de formas, dadas as novas chaves e pedacos
+// de cada uma (calculados por calcularIndice). Cada ladrilho afetado é filtrado uma única vez
+void indexarFormas(std::vector<forma*>& alvos, std::vector<std::vector<long long>>& novasChaves,
+                   std::vector<listaPedacos>& novosPedacos) {
+    ++versaoCena;
+    std::vector<long long> afetados;
+    for (forma* f : alvos) {
+        f->editadaEm = versaoCena;
+        marcarSuja(*f);
+        f->emLote = true;
+        afetados.insert(afetados.end(), f->chaves.begin(), f->chaves.end());
+    }
+    std::sort(afetados.begin(), afetados.end());
+    afetados.erase(std::unique(afetados.begin(), afetados.end()), afetados.end());
+
+    // Retira as formas do lote dos ladrilhos antigos, liberando os que ficarem vazios
+    for (long long chave : afetados) {
+        auto it = ladrilhos.find(chave);
+        if (it == ladrilhos.end()) continue;
+        auto& lista = it->second.formas;
+        lista.erase(std::remove_if(lista.begin(), lista.end(), [](const entradaLadrilho& e) { return e.f->emLote; }), lista.end());
+        it->second.versao = versaoCena;
+        if (lista.empty()) ladrilhos.erase(it);
+    }
+
+    for (size_t i = 0; i < alvos.size(); ++i) {
+        forma* f = alvos[i];
+        f->emLote = false;
+        f->chaves.swap(novasChaves[i]);
+        f->pedacos = std::make_shared<const listaPedacos>(std::move(novosPedacos[i]));
+        for (size_t j = 0; j < f->chaves.size(); ++j) {
+            ladrilho& t = ladrilhos[f->chaves[j]];
+            t.formas.push_back({f, (*f->pedacos)[j]});
+            t.versao = versaoCena;
+        }
+    }
+}
+
+// Função que rasteriza numa máscara de bits o contorno e o preenchimento de todas
+// as formas que tocam o ladrilho (tx, ty), a partir apenas dos seus pedacos nele
+void rasterizarMascara(int tx, int ty, std::pmr::vector<uint64_t>& mascara) {
+    mascara.assign(LADO_LADRILHO * LADO_LADRILHO / 64, 0);
+    auto it = ladrilhos.find(chaveLadrilho(tx, ty));
+    if (it == ladrilhos.end()) return;
+
+    int x0 = tx * LADO_LADRILHO, y0 = ty * LADO_LADRILHO;
+    for (const auto& e : it->second.formas) {
+        recorteLadrilho r = recorteDe(*e.f, e.pedaco.get(), tx, ty);
+        int y, xIni, xFim;
+        for (size_t i = 0; i < r.total(); ++i) {
+            if (!faixaDoRecorte(r, i, y, xIni, xFim) || y < y0 || y >= y0 + LADO_LADRILHO) continue;
+            // Marca os bits de xIni a xFim da linha, uma palavra de 64 bits por vez
+            int ini = (y - y0) * LADO_LADRILHO + xIni - x0, fim = (y - y0) * LADO_LADRILHO + xFim - x0;
+            while (ini <= fim) {
+                int n = std::min(64 - (ini & 63), fim - ini + 1);
+                uint64_t bits = n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1);
+                mascara[ini >> 6] |= bits << (ini & 63);
+                ini += n;
+            }
+        }
+    }
+}
+
+/*
+ * Gravacao e reproducao de entrada
+ * A trilha e um arquivo texto com um evento por linha: "<microssegundos> <tipo> a b c d"
+ * Tipos: m mouse, k teclado, p movimento passivo, n movimento com botao pressionado,
+ * s tecla especial, u menu, r janela
+ */
+struct eventoEntrada{
+    long long t;
+    char tipo;
+    int a, b, c, d;
+};
+
+std::vector<eventoEntrada> trilha; // eventos a reproduzir
+size_t proximoEvento = 0;
+std::chrono::steady_clock::time_point inicioReproducao;
+std::vector<double> latencias; // em milissegundos, uma por evento
+// Instantes de despacho dos eventos que aguardam o proximo quadro desenhado
+std::vector<std::chrono::steady_clock::time_point> aguardandoQuadro;
+long quadrosReproducao = 0;
+
+// Funcao para pedir que a janela seja redesenhada (sem efeito na reproducao sem janela)
+void pedirRedesenho() {
+    redesenhoPendente = true;
+    if (!semJanela) glutPostRedisplay();
+}
+
+// Funcao para registrar um evento de entrada na trilha sendo gravada
+void gravarEvento(char tipo, int a, int b, int c, int d) {
+    if (!arquivoGravacao) return;
+    long long t = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - inicioRelogio).count();
+    fprintf(arquivoGravacao, "%lld %c %d %d %d %d\n", t, tipo, a, b, c, d);
+}
+
+// Funcao para ler uma trilha gravada
+bool carregarTrilha(const char* caminho) {
+    FILE* arquivo = fopen(caminho, "r");
+    if (!arquivo) return false;
+    eventoEntrada e;
+    while (fscanf(arquivo, "%lld %c %d %d %d %d", &e.t, &e.tipo, &e.a, &e.b, &e.c, &e.d) == 6) {
+        trilha.push_back(e);
+    }
+    fclose(arquivo);
+    return true;
+}
+
+// Funcao que entrega um evento gravado ao callback correspondente
+void despacharEvento(const eventoEntrada& e) {
+    switch (e.tipo) {
+        case 'm': mouse(e.a, e.b, e.c, e.d); break;
+        case 'k': keyboard(static_cast<unsigned char>(e.a), e.b, e.c); break;
+        case 'p': mousePassiveMotion(e.a, e.b); break;
+        case 'n': mouseMotion(e.a, e.b); break;
+        case 's': special(e.a, e.b, e.c); break;
+        case 'u': menu_popup(e.a); break;
+        case 'r':
+            // Com janela, o GLUT chama reshape quando o tamanho efetivamente muda
+            if (semJanela) reshape(e.a, e.b);
+            else glutReshapeWindow(e.a, e.b);
+            break;
+    }
+}
+
+// Funcao que indica se o evento encerraria o programa (ESC ou "Sair" no menu)
+bool eventoDeSaida(const eventoEntrada& e) {
+    return (e.tipo == 'k' && e.a == ESC) || (e.tipo == 'u' && e.a == 0);
+}
+
+// Funcao que imprime latencia por evento e vazao da reproducao, e encerra o programa
+void encerrarReproducao() {
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - inicioReproducao).count();
+    size_t n = latencias.size();
+    printf("Reproducao: %zu eventos em %.3f s (%.1f eventos/s), %ld quadros\n",
+           n, total, total > 0 ? n / total : 0.0, quadrosReproducao);
+    if (n > 0) {
+        std::vector<double> ordenadas = latencias;
+        std::sort(ordenadas.begin(), ordenadas.end());
+        double soma = 0;
+        for (double l : ordenadas) soma += l;
+        auto percentil = [&](double p) { return ordenadas[std::min(n - 1, static_cast<size_t>(p * n))]; };
+        printf("Latencia por evento (ms): media %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+               soma / n, percentil(0.50), percentil(0.95), percentil(0.99), ordenadas.back());
+    }
+    exit(EXIT_SUCCESS);
+}
+
+// Funcao que despacha um evento e mede sua latencia
+// Com janela, a latencia vai ate o fim do quadro que mostra o efeito do evento
+void reproduzirEvento(const eventoEntrada& e) {
+    auto inicio = std::chrono::steady_clock::now();
+    redesenhoPendente = false;
+    despacharEvento(e);
+    if (redesenhoPendente && !semJanela) {
+        aguardandoQuadro.push_back(inicio);
+    } else {
+        latencias.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count());
+    }
+}
+
+// Funcao chamada ao fim de cada quadro durante a reproducao com janela
+void quadroConcluido() {
+    auto agora = std::chrono::steady_clock::now();
+    for (const auto& inicio : aguardandoQuadro) {
+        latencias.push_back(std::chrono::duration<double, std::milli>(agora - inicio).count());
+    }
+    aguardandoQuadro.clear();
+    ++quadrosReproducao;
+}
+
+// Funcao ociosa do GLUT que alimenta a trilha, no ritmo gravado ou o mais rapido possivel
+void reproduzirPasso() {
+    if (proximoEvento == 0) inicioReproducao = std::chrono::steady_clock::now();
+    if (proximoEvento >= trilha.size() || eventoDeSaida(trilha[proximoEvento])) {
+        // Espera o ultimo quadro pendente antes de relatar
+        if (aguardandoQuadro.empty()) encerrarReproducao();
+        return;
+    }
+    const eventoEntrada& e = trilha[proximoEvento];
+    if (!reproducaoRapida) {
+        long long decorrido = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - inicioReproducao).count();
+        if (decorrido < e.t - trilha.front().t) {
+            std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000LL, e.t - trilha.front().t - decorrido)));
+            return;
+        }
+    }
+    ++proximoEvento;
+    reproduzirEvento(e);
+}
+
+// Funcao que reproduz a trilha sem janela, medindo apenas o processamento dos eventos
+void reproduzirSemJanela() {
+    inicioReproducao = std::chrono::steady_clock::now();
+    for (const auto& e : trilha) {
+        if (eventoDeSaida(e)) break;
+        if (!reproducaoRapida) {
+            std::this_thread::sleep_until(inicioReproducao + std::chrono::microseconds(e.t - trilha.front().t));
+        }
+        reproduzirEvento(e);
+    }
+    encerrarReproducao();
+}
+
+/*
+ * Contabilidade de memoria
+ * Os bytes sao estimativas do que o alocador entrega: cada no de lista encadeada
+ * e cada buffer de vetor custa o pedido arredondado mais o cabecalho do bloco
+ */
+struct memoriaForma{
+    size_t vertices = 0, faixas = 0, ladrilhos = 0; // quantidade de nos/faixas/entradas
+    size_t bytesVertices = 0, bytesFaixas = 0, bytesLadrilhos = 0;
+    size_t bytes() const { return sizeof(forma) + bytesVertices + bytesFaixas + bytesLadrilhos; }
+};
+
+// Função que estima o custo de um bloco pedido ao alocador (cabecalho de 8 bytes,
+// alinhamento de 16 e bloco minimo de 32, como no malloc da glibc)
+size_t custoAlocacao(size_t pedido) {
+    return std::max<size_t>(32, (pedido + 8 + 15) & ~size_t(15));
+}
+
+// Função que atualiza um pico de memoria transitoria (pode ser chamada de varias threads)
+void registrarPico(std::atomic<size_t>& pico, size_t bytes) {
+    size_t atual = pico.load();
+    while (bytes > atual && !pico.compare_exchange_weak(atual, bytes)) {}
+}
+
+// Função que mede a memoria de uma forma
+memoriaForma medirForma(const forma& f) {
+    memoriaForma m;
+    for (auto it = f.v.begin(); it != f.v.end(); ++it) ++m.vertices;
+    m.faixas = f.faixas.size();
+    m.bytesFaixas = f.faixas.capacity() ? custoAlocacao(f.faixas.capacity() * sizeof(faixa)) : 0;
+    m.ladrilhos = f.chaves.size();
+    m.bytesVertices = m.vertices * custoAlocacao(sizeof(void*) + sizeof(vertice));
+    m.bytesLadrilhos = f.chaves.capacity() ? custoAlocacao(f.chaves.capacity() * sizeof(long long)) : 0;
+    // Cada pedaco, e a lista deles, e um bloco com o contador do shared_ptr mais o seu buffer
+    if (f.pedacos) {
+        for (const auto& p : *f.pedacos) {
+            if (!p) continue;
+            m.faixas += p->faixas.size();
+            m.bytesFaixas += custoAlocacao(sizeof(pedacoForma) + 2 * sizeof(long)) +
+                             (p->faixas.capacity() ? custoAlocacao(p->faixas.capacity() * sizeof(faixa)) : 0);
+        }
+        m.bytesLadrilhos += custoAlocacao(sizeof(listaPedacos) + 2 * sizeof(long)) +
+                            (f.pedacos->capacity() ? custoAlocacao(f.pedacos->capacity() * sizeof((*f.pedacos)[0])) : 0);
+    }
+    return m;
+}
+
+// Totais da cena, recalculados apenas quando a cena muda
+struct memoriaCena{
+    size_t formas = 0;
+    memoriaForma soma;
+    size_t ladrilhos = 0, bytesLadrilhos = 0; // mapa de ladrilhos do canvas
+    size_t definicoes = 0, rasters = 0, bytesDefinicoes = 0; // geometria compartilhada pelas instancias
+    // Cada forma e um no da lista encadeada; soma.bytes() ja conta um sizeof(forma)
+    size_t bytes() const {
+        return formas * custoAlocacao(sizeof(void*) + sizeof(forma)) + soma.bytes() - sizeof(forma) + bytesLadrilhos + bytesDefinicoes;
+    }
+};
+
+memoriaCena medirCena() {
+    memoriaCena c;
+    std::vector<const definicao*> definicoes;
+    for (const auto& f : formas) {
+        if (f.def) definicoes.push_back(f.def.get());
+        memoriaForma m = medirForma(f);
+        ++c.formas;
+        c.soma.vertices += m.vertices;
+        c.soma.faixas += m.faixas;
+        c.soma.ladrilhos += m.ladrilhos;
+        c.soma.bytesVertices += m.bytesVertices;
+        c.soma.bytesFaixas += m.bytesFaixas;
+        c.soma.bytesLadrilhos += m.bytesLadrilhos;
+    }
+    c.ladrilhos = ladrilhos.size();
+    c.bytesLadrilhos = ladrilhos.bucket_count() * sizeof(void*);
+    for (const auto& par : ladrilhos) {
+        c.bytesLadrilhos += custoAlocacao(sizeof(void*) + sizeof(par) + sizeof(size_t));
+        if (par.second.formas.capacity()) c.bytesLadrilhos += custoAlocacao(par.second.formas.capacity() * sizeof(entradaLadrilho));
+    }
+    // Cada definicao e contada uma unica vez, qualquer que seja o numero de instancias
+    std::sort(definicoes.begin(), definicoes.end());
+    definicoes.erase(std::unique(definicoes.begin(), definicoes.end()), definicoes.end());
+    for (const definicao* d : definicoes) {
+        ++c.definicoes;
+        c.bytesDefinicoes += custoAlocacao(sizeof(definicao) + 2 * sizeof(size_t));
+        for (auto it = d->v.begin(); it != d->v.end(); ++it) c.bytesDefinicoes += custoAlocacao(sizeof(void*) + sizeof(vertice));
+        if (d->preenchimentoOriginal) {
+            const auto& faixas = d->preenchimentoOriginal->faixas;
+            c.bytesDefinicoes += custoAlocacao(sizeof(pedacoForma) + 2 * sizeof(long)) +
+                                 (faixas.capacity() ? custoAlocacao(faixas.capacity() * sizeof(faixa)) : 0);
+        }
+        for (const auto& par : d->rasters) {
+            ++c.rasters;
+            c.bytesDefinicoes += custoAlocacao(sizeof(par) + 4 * sizeof(void*)) + custoAlocacao(sizeof(rasterDefinicao) + 2 * sizeof(size_t));
+            const rasterDefinicao& r = *par.second;
+            if (r.contorno.capacity()) c.bytesDefinicoes += custoAlocacao(r.contorno.capacity() * sizeof(faixa));
+            if (r.preenchimento.capacity()) c.bytesDefinicoes += custoAlocacao(r.preenchimento.capacity() * sizeof(faixa));
+        }
+    }
+    return c;
+}
+
+// Função que desenha o resumo de memoria acima das coordenadas do mouse
+// Espera a projecao em coordenadas da janela
+void desenharMemoria() {
+    static memoriaCena medida;
+    static unsigned long versaoMedida = ~0UL;
+    if (versaoMedida != versaoCena) {
+        medida = medirCena();
+        versaoMedida = versaoCena;
+    }
+    const double MB = 1024.0 * 1024.0;
+    char linha[160];
+    snprintf(linha, sizeof(linha), "mem %.1fMB formas %zu vertices %zu (%.1fMB) faixas %zu (%.1fMB)",
+             medida.bytes() / MB, medida.formas, medida.soma.vertices, medida.soma.bytesVertices / MB,
+             medida.soma.faixas, medida.soma.bytesFaixas / MB);
+    draw_text_stroke(0, 40, linha, 0.1);
+    snprintf(linha, sizeof(linha), "ladrilhos %zu (%.1fMB) pico: poligono %.1fMB flood %.1fMB cena %.1fMB",
+             medida.ladrilhos, medida.bytesLadrilhos / MB, picoPreencherPoligono / MB,
+             picoFloodFill / MB, picoPreencherCena / MB);
+    draw_text_stroke(0, 25, linha, 0.1);
+    int y = 55;
+#ifdef CONTAR_ALOCACOES
+    snprintf(linha, sizeof(linha), "alocacoes no ultimo quadro %zu", alocacoesUltimoQuadro);
+    draw_text_stroke(0, y, linha, 0.1);
+    y += 15;
+#endif
+    snprintf(linha, sizeof(linha), "rascunho %.1fMB definicoes %zu rasters %zu (%.1fMB)", rascunho().reservado() / MB,
+             medida.definicoes, medida.rasters, medida.bytesDefinicoes / MB);
+    draw_text_stroke(0, y, linha, 0.1);
+}
+
+// Função que grava a contabilidade de memoria, por forma e total, em JSON
+void salvarMemoriaJSON(const char* caminho) {
+    FILE* arquivo = fopen(caminho, "w");
+    if (!arquivo) {
+        fprintf(stderr, "Nao foi possivel criar %s\n", caminho);
+        return;
+    }
+    auto escreverForma = [&](const memoriaForma& m) {
+        fprintf(arquivo, "\"vertices\": {\"nos\": %zu, \"bytes\": %zu}, "
+                         "\"faixas\": {\"nos\": %zu, \"bytes\": %zu}, "
+                         "\"ladrilhos\": {\"entradas\": %zu, \"bytes\": %zu}, \"bytes\": %zu",
+                m.vertices, m.bytesVertices, m.faixas, m.bytesFaixas,
+                m.ladrilhos, m.bytesLadrilhos, m.bytes());
+    };
+    fprintf(arquivo, "{\n  \"formas\": [");
+    bool primeira = true;
+    for (const auto& f : formas) {
+        fprintf(arquivo, "%s\n    {\"id\": %d, \"tipo\": %d, ", primeira ? "" : ",", f.id, f.tipo);
+        escreverForma(medirForma(f));
+        fprintf(arquivo, "}");
+        primeira = false;
+    }
+    memoriaCena c = medirCena();
+    fprintf(arquivo, "\n  ],\n  \"totais\": {\"formas\": %zu, ", c.formas);
+    memoriaForma soma = c.soma;
+    escreverForma(soma);
+    fprintf(arquivo, "},\n  \"canvas\": {\"ladrilhos\": %zu, \"bytes\": %zu},\n", c.ladrilhos, c.bytesLadrilhos);
+    fprintf(arquivo, "  \"definicoes\": {\"definicoes\": %zu, \"rasters\": %zu, \"bytes\": %zu},\n",
+            c.definicoes, c.rasters, c.bytesDefinicoes);
+    fprintf(arquivo, "  \"picoTransitorio\": {\"preencherPoligono\": %zu, \"floodFill\": %zu, \"preencherCena\": %zu},\n",
+            picoPreencherPoligono.load(), picoFloodFill.load(), picoPreencherCena.load());
+    fprintf(arquivo, "  \"bytes\": %zu\n}\n", c.bytes());
+    fclose(arquivo);
+    printf("Contabilidade de memoria gravada em %s\n", caminho);
+}
+
+/*
+ * Salvamento automatico
+ * A thread da interface apenas copia as formas alteradas desde o ultimo salvamento
+ * para registros imutaveis, dentro de um orcamento de tempo, e os entrega a uma
+ * thread de gravacao. O preenchimento nao e copiado: o registro compartilha os
+ * pedacos imutaveis da forma, e o custo da copia nao depende do numero de faixas.
+ * A thread de gravacao mantem um espelho da cena salva, acrescenta os registros
+ * ao arquivo e, de tempos em tempos, o compacta reescrevendo o espelho.
+ *
+ * Formato (texto):
+ *   paint-autosave 4
+ *   D id tipo preenchido estilo ox oy nv x y ... nf y xIni xFim ...  (definicao de carimbo)
+ *   F id tipo preenchido r g b estilo nv x y ... nf y xIni xFim ...
+ *   I id definicao r g b m00 m01 m02 m10 m11 m12                (instancia)
+ *   S
+ * (a versao 1 nao tem o campo estilo, so as versoes 3 e 4 tem D e I, e so a 4 tem
+ * o preenchimento original das definicoes)
+ * Cada lote termina com S; registros de um lote incompleto sao ignorados na
+ * recuperacao, e um registro posterior de uma forma substitui os anteriores
+ */
+struct registroForma{
+    char marca = 'F'; // F forma, I instancia ou D definicao
+    int id, tipo;
+    bool preenchido;
+    int cor[3];
+    int estilo;
+    std::vector<vertice> v; // na ordem da lista da forma
+    // Preenchimento: ao salvar, os pedacos imutaveis da forma, compartilhados sem copia e
+    // reunidos em faixas so pela thread de gravacao; ao recuperar, as faixas lidas
+    std::shared_ptr<const listaPedacos> pedacos;
+    std::vector<faixa> faixas;
+    int definicao = -1; // instancias
+    float matriz[6]; // instancias: as duas primeiras linhas da matriz afim; definicoes: a origem
+    // Definicoes e formas tem numeracoes proprias: as definicoes usam chaves negativas
+    int chave() const { return marca == 'D' ? -id - 1 : id; }
+};
+
+std::vector<forma*> formasSujas; // alteradas desde o ultimo salvamento
+size_t primeiraSuja = 0; // as formas sujas antes desta ja foram entregues
+const double ORCAMENTO_AUTOSALVAR = 0.5; // ms de copia por passo na thread da interface
+
+std::mutex mutexAutosalvar;
+std::condition_variable sinalAutosalvar;
+std::vector<std::vector<registroForma>> lotesPendentes;
+bool encerrarAutosalvar = false;
+std::thread threadAutosalvar;
+
+// Função que marca uma forma como alterada para o proximo salvamento
+void marcarSuja(forma& f) {
+    if (f.suja) return;
+    f.suja = true;
+    formasSujas.push_back(&f);
+}
+
+// Função que copia o estado de uma forma em um registro imutavel
+registroForma copiarForma(const forma& f) {
+    registroForma r;
+    r.id = f.id;
+    r.tipo = f.tipo;
+    r.preenchido = f.preenchido;
+    for (int i = 0; i < 3; ++i) r.cor[i] = f.cor[i];
+    r.estilo = f.estilo;
+    if (f.tipo == INST) {
+        r.marca = 'I';
+        r.definicao = f.def->id;
+        for (int i = 0; i < 6; ++i) r.matriz[i] = f.matriz[i / 3][i % 3];
+        return r;
+    }
+    for (const auto& vert : f.v) r.v.push_back(vert);
+    r.pedacos = f.pedacos;
+    return r;
+}
+
+// Função que copia uma definicao de carimbo (imutavel) em um registro
+registroForma copiarDefinicao(const definicao& d) {
+    registroForma r;
+    r.marca = 'D';
+    r.id = d.id;
+    r.tipo = d.tipo;
+    r.preenchido = d.preenchido;
+    r.estilo = d.estilo;
+    r.matriz[0] = d.origem.x;
+    r.matriz[1] = d.origem.y;
+    for (const auto& vert : d.v) r.v.push_back(vert);
+    if (d.preenchimentoOriginal) r.pedacos = std::make_shared<const listaPedacos>(1, d.preenchimentoOriginal);
+    return r;
+}
+
+void escreverRegistro(FILE* arquivo, const registroForma& r) {
+    // Preenchimento: nf seguido das faixas
+    auto escreverFaixas = [&]() {
+        std::vector<faixa> reunidas;
+        const std::vector<faixa>* faixas = &r.faixas;
+        if (r.pedacos) {
+            reunirFaixas(r.pedacos.get(), reunidas);
+            faixas = &reunidas;
+        }
+        fprintf(arquivo, " %zu", faixas->size());
+        for (const auto& fx : *faixas) fprintf(arquivo, " %d %d %d", fx.y, fx.xIni, fx.xFim);
+    };
+    if (r.marca == 'D') {
+        fprintf(arquivo, "D %d %d %d %d %d %d %zu", r.id, r.tipo, r.preenchido ? 1 : 0, r.estilo,
+                static_cast<int>(r.matriz[0]), static_cast<int>(r.matriz[1]), r.v.size());
+        for (const auto& vert : r.v) fprintf(arquivo, " %d %d", vert.x, vert.y);
+        escreverFaixas();
+        fputc('\n', arquivo);
+        return;
+    }
+    if (r.marca == 'I') {
+        fprintf(arquivo, "I %d %d %d %d %d", r.id, r.definicao, r.cor[0], r.cor[1], r.cor[2]);
+        for (int i = 0; i < 6; ++i) fprintf(arquivo, " %.9g", r.matriz[i]);
+        fputc('\n', arquivo);
+        return;
+    }
+    fprintf(arquivo, "F %d %d %d %d %d %d %d %zu", r.id, r.tipo, r.preenchido ? 1 : 0,
+            r.cor[0], r.cor[1], r.cor[2], r.estilo, r.v.size());
+    for (const auto& vert : r.v) fprintf(arquivo, " %d %d", vert.x, vert.y);
+    escreverFaixas();
+    fputc('\n', arquivo);
+}
+
+// Função que reescreve o arquivo com o espelho da cena, trocando-o de forma atomica
+FILE* compactarAutosalvamento(const unordered_map<int, registroForma>& espelho) {
+    std::string temporario = std::string(arquivoAutosalvar) + ".tmp";
+    FILE* arquivo = fopen(temporario.c_str(), "w");
+    if (!arquivo) {
+        fprintf(stderr, "Nao foi possivel criar %s\n", temporario.c_str());
+        return nullptr;
+    }
+    fprintf(arquivo, "paint-autosave 4\n");
+    for (const auto& par : espelho) escreverRegistro(arquivo, par.second);
+    fprintf(arquivo, "S\n");
+    fclose(arquivo);
+    if (std::rename(temporario.c_str(), arquivoAutosalvar) != 0) {
+        fprintf(stderr, "Nao foi possivel substituir %s\n", arquivoAutosalvar);
+        return nullptr;
+    }
+    return fopen(arquivoAutosalvar, "a");
+}
+
+// Laco da thread de gravacao
+void gravarAutosalvamento() {
+    unordered_map<int, registroForma> espelho; // ultimo estado salvo de cada forma e definicao
+    FILE* arquivo = nullptr;
+    size_t registrosNoArquivo = 0;
+    while (true) {
+        std::vector<std::vector<registroForma>> lotes;
+        bool encerrar;
+        {
+            std::unique_lock<std::mutex> trava(mutexAutosalvar);
+            sinalAutosalvar.wait(trava, [] { return encerrarAutosalvar || !lotesPendentes.empty(); });
+            lotes.swap(lotesPendentes);
+            encerrar = encerrarAutosalvar;
+        }
+        for (auto& lote : lotes) {
+            // O primeiro lote e sempre gravado como uma copia completa
+            if (arquivo) {
+                for (const auto& r : lote) escreverRegistro(arquivo, r);
+                fprintf(arquivo, "S\n");
+                fflush(arquivo);
+                registrosNoArquivo += lote.size();
+            }
+            for (auto& r : lote) {
+                int chave = r.chave();
+                espelho[chave] = std::move(r);
+            }
+            // Compacta quando o arquivo acumula muito mais registros do que formas
+            if (!arquivo || registrosNoArquivo > 2 * espelho.size() + 256) {
+                if (arquivo) fclose(arquivo);
+                arquivo = compactarAutosalvamento(espelho);
+                registrosNoArquivo = espelho.size();
+            }
+        }
+        if (encerrar) break;
+    }
+    if (arquivo) fclose(arquivo);
+}
+
+// Função que copia as formas sujas e entrega o lote a thread de gravacao
+// Com limite de tempo, as formas que nao couberem no orcamento ficam para o proximo passo
+void entregarFormasSujas(bool comLimite) {
+    if (primeiraSuja == formasSujas.size()) return;
+    auto inicio = std::chrono::steady_clock::now();
+    std::vector<registroForma> lote;
+    while (primeiraSuja < formasSujas.size()) {
+        forma* f = formasSujas[primeiraSuja++];
+        f->suja = false;
+        // A definicao de um carimbo e gravada uma unica vez, antes da sua primeira instancia
+        if (f->tipo == INST && !f->def->salva) {
+            lote.push_back(copiarDefinicao(*f->def));
+            f->def->salva = true;
+        }
+        lote.push_back(copiarForma(*f));
+        if (comLimite &&
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count() > ORCAMENTO_AUTOSALVAR) {
+            break;
+        }
+    }
+    // Entregues todas, a lista recomeca sem liberar a sua memoria
+    if (primeiraSuja == formasSujas.size()) {
+        formasSujas.clear();
+        primeiraSuja = 0;
+    }
+    {
+        std::lock_guard<std::mutex> trava(mutexAutosalvar);
+        lotesPendentes.push_back(std::move(lote));
+    }
+    sinalAutosalvar.notify_one();
+}
+
+// Ao sair do programa (inclusive por ESC), grava o que faltar e espera a thread
+void encerrarAutosalvamento() {
+    if (!threadAutosalvar.joinable()) return;
+    entregarFormasSujas(false);
+    {
+        std::lock_guard<std::mutex> trava(mutexAutosalvar);
+        encerrarAutosalvar = true;
+    }
+    sinalAutosalvar.notify_one();
+    threadAutosalvar.join();
+}
+
+void iniciarAutosalvamento() {
+    threadAutosalvar = std::thread(gravarAutosalvamento);
+    atexit(encerrarAutosalvamento);
+}
+
+// Passo periodico, chamado por temporizador na thread da interface
+// Enquanto restarem formas sujas (depois de uma alteracao em lote), o proximo passo
+// vem logo em seguida, entre os eventos, em vez de esperar o intervalo inteiro
+void autosalvarPasso(int valor) {
+    entregarFormasSujas(true);
+    glutTimerFunc(primeiraSuja < formasSujas.size() ? 0 : INTERVALO_AUTOSALVAR, autosalvarPasso, valor);
+}
+
+// Função que recria as formas a partir de um arquivo de salvamento automatico
+bool recuperarFormas(const char* caminho) {
+    FILE* arquivo = fopen(caminho, "r");
+    if (!arquivo) return false;
+    int versao;
+    if (fscanf(arquivo, " paint-autosave %d", &versao) != 1 || versao < 1 || versao > 4) {
+        fclose(arquivo);
+        return false;
+    }
+    std::map<int, registroForma> salvas, lote;
+    char marca;
+    while (fscanf(arquivo, " %c", &marca) == 1) {
+        if (marca == 'S') {
+            // Lote completo
+            for (auto& par : lote) salvas[par.first] = std::move(par.second);
+            lote.clear();
+            continue;
+        }
+        registroForma r;
+        r.marca = marca;
+        int preenchido;
+        size_t nv, nf;
+        if (marca == 'I') {
+            if (fscanf(arquivo, "%d %d %d %d %d", &r.id, &r.definicao, &r.cor[0], &r.cor[1], &r.cor[2]) != 5) break;
+            bool completo = true;
+            for (int i = 0; i < 6 && completo; ++i) completo = fscanf(arquivo, "%f", &r.matriz[i]) == 1;
+            if (!completo) break;
+            lote[r.chave()] = std::move(r);
+            continue;
+        }
+        if (marca == 'D') {
+            int ox, oy;
+            if (fscanf(arquivo, "%d %d %d %d %d %d %zu", &r.id, &r.tipo, &preenchido, &r.estilo, &ox, &oy, &nv) != 7) break;
+            r.matriz[0] = ox;
+            r.matriz[1] = oy;
+            r.preenchido = preenchido != 0;
+            bool completo = true;
+            for (size_t i = 0; i < nv && completo; ++i) {
+                vertice vert;
+                completo = fscanf(arquivo, "%d %d", &vert.x, &vert.y) == 2;
+                r.v.push_back(vert);
+            }
+            if (versao >= 4) {
+                completo = completo && fscanf(arquivo, "%zu", &nf) == 1;
+                for (size_t i = 0; completo && i < nf; ++i) {
+                    faixa fx;
+                    completo = fscanf(arquivo, "%d %d %d", &fx.y, &fx.xIni, &fx.xFim) == 3;
+                    r.faixas.push_back(fx);
+                }
+            }
+            if (!completo) break;
+            lote[r.chave()] = std::move(r);
+            continue;
+        }
+        if (marca != 'F' || fscanf(arquivo, "%d %d %d %d %d %d", &r.id, &r.tipo, &preenchido,
+                                   &r.cor[0], &r.cor[1], &r.cor[2]) != 6) break;
+        r.estilo = SOLIDO;
+        if (versao >= 2 && fscanf(arquivo, "%d", &r.estilo) != 1) break;
+        if (fscanf(arquivo, "%zu", &nv) != 1) break;
+        r.preenchido = preenchido != 0;
+        bool completo = true;
+        for (size_t i = 0; i < nv && completo; ++i) {
+            vertice vert;
+            completo = fscanf(arquivo, "%d %d", &vert.x, &vert.y) == 2;
+            r.v.push_back(vert);
+        }
+        completo = completo && fscanf(arquivo, "%zu", &nf) == 1;
+        for (size_t i = 0; completo && i < nf; ++i) {
+            faixa fx;
+            completo = fscanf(arquivo, "%d %d %d", &fx.y, &fx.xIni, &fx.xFim) == 3;
+            r.faixas.push_back(fx);
+        }
+        if (!completo) break; // registro truncado por uma queda
+        lote[r.chave()] = std::move(r);
+    }
+    fclose(arquivo);
+
+    // As definicoes (chaves negativas) vem antes das formas no mapa ordenado, e as formas
+    // sao recriadas da mais antiga para a mais recente, que fica no inicio da lista
+    std::map<int, std::shared_ptr<definicao>> definicoes;
+    size_t recuperadas = 0;
+    for (auto& par : salvas) {
+        registroForma& r = par.second;
+        if (r.marca == 'D') {
+            auto def = std::make_shared<definicao>();
+            def->id = r.id;
+            def->tipo = r.tipo;
+            def->preenchido = r.preenchido;
+            def->estilo = r.estilo;
+            def->origem = {static_cast<int>(r.matriz[0]), static_cast<int>(r.matriz[1])};
+            def->v.assign(r.v.begin(), r.v.end());
+            if (!r.faixas.empty()) {
+                auto preenchimento = std::make_shared<pedacoForma>();
+                preenchimento->faixas = std::move(r.faixas);
+                def->preenchimentoOriginal = std::move(preenchimento);
+            }
+            definicoes[r.id] = def;
+            proximaDefinicao = std::max(proximaDefinicao, r.id + 1);
+            continue;
+        }
+        ++recuperadas;
+        if (r.marca == 'I') {
+            auto def = definicoes.find(r.definicao);
+            if (def == definicoes.end()) continue;
+            matriz3 matriz = {{{r.matriz[0], r.matriz[1], r.matriz[2]}, {r.matriz[3], r.matriz[4], r.matriz[5]}, {0, 0, 1}}};
+            forma& f = pushInstancia(def->second, matriz, r.cor);
+            f.id = r.id;
+            proximoId = std::max(proximoId, r.id + 1);
+            indexarForma(f);
+            continue;
+        }
+        pushForma(r.tipo);
+        forma& f = formas.front();
+        f.id = r.id;
+        f.preenchido = r.preenchido;
+        for (int i = 0; i < 3; ++i) f.cor[i] = r.cor[i];
+        f.estilo = r.estilo;
+        f.v.assign(r.v.begin(), r.v.end());
+        abrirFaixas(f).assign(r.faixas.begin(), r.faixas.end());
+        proximoId = std::max(proximoId, r.id + 1);
+        indexarForma(f);
+    }
+    printf("%zu formas recuperadas de %s\n", recuperadas, caminho);
+    return true;
+}
+
+/*
+ * Renderizacao progressiva
+ * As formas visiveis sao desenhadas em ordem de prioridade (as editadas mais
+ * recentemente e, entre elas, as maiores primeiro) ate esgotar o orcamento do
+ * quadro. O que ja foi desenhado fica acumulado em uma textura do tamanho da
+ * janela, copiada do buffer a cada quadro, e o proximo quadro continua de onde o
+ * anterior parou. A previa do mouse e os destaques de selecao sao desenhados por
+ * cima a cada quadro, sem entrar na textura. Qualquer alteracao da cena ou da
+ * camera recomeca o desenho
+ * A prioridade so decide o que aparece primeiro: depois da fila, os ladrilhos em
+ * que a ordem de prioridade diverge da ordem da lista sao redesenhados na ordem
+ * da lista, e o quadro completo fica igual ao de drawFormas
+ */
+struct progresso{
+    std::vector<forma*> fila; // formas visiveis em ordem de prioridade
+    size_t proxima = 0; // proxima forma da fila a desenhar
+    std::vector<long long> ajustes; // ladrilhos a redesenhar na ordem da lista, depois da fila
+    size_t proximoAjuste = 0;
+    bool iniciado = false;
+    unsigned long versao = 0; // versaoCena quando a fila foi montada
+    double camX = 0, camY = 0, zoom = 0;
+    int largura = 0, altura = 0;
+    GLuint textura = 0;
+    int texLargura = 0, texAltura = 0; // potencias de 2 que cobrem a janela
+} progressivo;
+
+// Função que verifica se a cena ou a camera mudaram desde que a fila foi montada
+bool progressoValido() {
+    return progressivo.iniciado && progressivo.versao == versaoCena && progressivo.camX == camX &&
+           progressivo.camY == camY && progressivo.zoom == zoom &&
+           progressivo.largura == width && progressivo.altura == height;
+}
+
+// Função que monta a fila de prioridade e garante uma textura do tamanho da janela
+void reiniciarProgresso() {
+    std::pmr::vector<forma*> visiveis(&rascunho());
+    coletarVisiveis(visiveis);
+    progressivo.fila.assign(visiveis.begin(), visiveis.end());
+    std::sort(progressivo.fila.begin(), progressivo.fila.end(), [](const forma* a, const forma* b) {
+        if (a->editadaEm != b->editadaEm) return a->editadaEm > b->editadaEm;
+        long long areaA = static_cast<long long>(a->xMax - a->xMin + 1) * (a->yMax - a->yMin + 1);
+        long long areaB = static_cast<long long>(b->xMax - b->xMin + 1) * (b->yMax - b->yMin + 1);
+        if (areaA != areaB) return areaA > areaB;
+        return a->id > b->id;
+    });
+    progressivo.proxima = 0;
+
+    // Ladrilhos em que as formas visiveis, na ordem da lista, nao seguem a ordem da fila
+    escopoRascunho escopo;
+    std::pmr::unordered_map<const forma*, size_t> posicao(escopo.recurso());
+    for (size_t i = 0; i < progressivo.fila.size(); ++i) posicao[progressivo.fila[i]] = i;
+    std::pmr::vector<const forma*> naLista(escopo.recurso());
+    int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+    int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+    int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+    progressivo.ajustes.clear();
+    progressivo.proximoAjuste = 0;
+    percorrerLadrilhos(vxMin, vyMin, vxMax, vyMax, [&](ladrilho& t, int tx, int ty) {
+        naLista.clear();
+        for (const auto& e : t.formas) {
+            if (posicao.count(e.f)) naLista.push_back(e.f);
+        }
+        std::sort(naLista.begin(), naLista.end(), [](const forma* a, const forma* b) { return a->id > b->id; });
+        for (size_t i = 1; i < naLista.size(); ++i) {
+            if (posicao[naLista[i - 1]] > posicao[naLista[i]]) {
+                progressivo.ajustes.push_back(chaveLadrilho(tx, ty));
+                break;
+            }
+        }
+    });
+    progressivo.iniciado = true;
+    progressivo.versao = versaoCena;
+    progressivo.camX = camX;
+    progressivo.camY = camY;
+    progressivo.zoom = zoom;
+    progressivo.largura = width;
+    progressivo.altura = height;
+
+    int texLargura = 1, texAltura = 1;
+    while (texLargura < width) texLargura *= 2;
+    while (texAltura < height) texAltura *= 2;
+    if (progressivo.textura == 0) glGenTextures(1, &progressivo.textura);
+    glBindTexture(GL_TEXTURE_2D, progressivo.textura);
+    if (texLargura != progressivo.texLargura || texAltura != progressivo.texAltura) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texLargura, texAltura, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+        progressivo.texLargura = texLargura;
+        progressivo.texAltura = texAltura;
+    }
+}
+
+// Função que desenha a textura acumulada cobrindo a janela, pixel a pixel
+void desenharAcumulado() {
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0, width, 0, height, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    double s = static_cast<double>(width) / progressivo.texLargura;
+    double t = static_cast<double>(height) / progressivo.texAltura;
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, progressivo.textura);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glBegin(GL_QUADS);
+    glTexCoord2d(0, 0); glVertex2i(0, 0);
+    glTexCoord2d(s, 0); glVertex2i(width, 0);
+    glTexCoord2d(s, t); glVertex2i(width, height);
+    glTexCoord2d(0, t); glVertex2i(0, height);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+// Função que compara o quadro progressivo recem-concluido, ja guardado na textura, com o
+// desenho direto de drawFormas, e imprime quantos pixels diferem (--conferir-progressivo)
+void conferirQuadroProgressivo() {
+    std::vector<uint8_t> progressivoRGB(static_cast<size_t>(width) * height * 3), diretoRGB(progressivoRGB.size());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, progressivoRGB.data());
+
+    glClear(GL_COLOR_BUFFER_BIT);
+    int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+    int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+    int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+    percorrerLadrilhos(vxMin, vyMin, vxMax, vyMax, [&](ladrilho& t, int tx, int ty) { desenharLadrilho(t, tx, ty); });
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, diretoRGB.data());
+
+    size_t diferentes = 0;
+    for (size_t i = 0; i < progressivoRGB.size(); i += 3) {
+        if (memcmp(&progressivoRGB[i], &diretoRGB[i], 3) != 0) ++diferentes;
+    }
+    if (diferentes == 0) printf("Renderizacao progressiva: quadro completo igual ao desenho direto\n");
+    else printf("Renderizacao progressiva: quadro completo difere do desenho direto em %zu pixels\n", diferentes);
+    fflush(stdout);
+    desenharAcumulado();
+}
+
+// Função que desenha as formas do quadro atual dentro do orcamento
+void desenharProgressivo() {
+    if (progressoValido()) desenharAcumulado();
+    else reiniciarProgresso();
+
+    auto inicio = std::chrono::steady_clock::now();
+    auto& fila = progressivo.fila;
+    auto& ajustes = progressivo.ajustes;
+    bool pendente = progressivo.proxima < fila.size() || progressivo.proximoAjuste < ajustes.size();
+    // Pelo menos uma forma ou ladrilho por quadro, para que o desenho sempre avance
+    do {
+        if (progressivo.proxima < fila.size()) {
+            desenharForma(*fila[progressivo.proxima++]);
+        } else if (progressivo.proximoAjuste < ajustes.size()) {
+            int tx, ty;
+            long long chave = ajustes[progressivo.proximoAjuste++];
+            coordenadasLadrilho(chave, tx, ty);
+            auto it = ladrilhos.find(chave);
+            if (it != ladrilhos.end()) desenharLadrilho(it->second, tx, ty);
+        } else {
+            break;
+        }
+    } while (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count() < orcamentoQuadro);
+    bool concluido = progressivo.proxima >= fila.size() && progressivo.proximoAjuste >= ajustes.size();
+
+    // Guarda o quadro acumulado antes de desenhar o que nao e permanente
+    glBindTexture(GL_TEXTURE_2D, progressivo.textura);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+    if (pendente && concluido && conferirProgressivo) conferirQuadroProgressivo();
+
+    desenharPrevia();
+    desenharSelecao();
+
+    if (!concluido) {
+        // Quadro incompleto: mostra o andamento e pede a continuacao
+        glColor3ub(0, 0, 0);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0, width, 0, height, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+        char andamento[64];
+        if (progressivo.proxima < fila.size()) {
+            snprintf(andamento, sizeof(andamento), "%zu/%zu formas", progressivo.proxima, fila.size());
+        } else {
+            snprintf(andamento, sizeof(andamento), "%zu/%zu ladrilhos", progressivo.proximoAjuste, ajustes.size());
+        }
+        draw_text_stroke(width - 170, 0, andamento, 0.12);
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        pedirRedesenho();
+    }
+}
+
+/*
+ * Estilos de preenchimento
+ * Cada faixa e avaliada de uma vez em uma linha de pixels RGBA. A geometria dos
+ * gradientes vem do retangulo envolvente da forma: o linear vai da esquerda para
+ * a direita e o radial parte do centro ate os cantos. Os pesos dos gradientes
+ * sao de ponto fixo com 15 bits (0 a 32767), e os nucleos SSE2 avaliam 8 pixels
+ * por vez; o codigo escalar produz exatamente os mesmos valores
+ */
+const int GRADIENTE_INICIO[3] = {0, 0, 255}; // Azul
+const int GRADIENTE_FIM[3] = {255, 200, 0}; // Amarelo
+const int HACHURA_FUNDO[3] = {255, 255, 255};
+const int HACHURA_TRACO[3] = {0, 0, 255};
+
+// Função que empacota uma cor em um pixel RGBA (bytes R, G, B, A na memoria)
+inline uint32_t empacotarRGBA(int r, int g, int b) {
+    return static_cast<uint32_t>(r) | static_cast<uint32_t>(g) << 8 | static_cast<uint32_t>(b) << 16 | 0xFF000000u;
+}
+
+// Cor do gradiente para o peso w em [0, 32767], igual a _mm_mulhi_epi16(2 * (fim - inicio), w)
+inline uint32_t corGradiente(int w) {
+    int c[3];
+    for (int i = 0; i < 3; ++i) {
+        c[i] = GRADIENTE_INICIO[i] + ((2 * (GRADIENTE_FIM[i] - GRADIENTE_INICIO[i]) * w) >> 16);
+    }
+    return empacotarRGBA(c[0], c[1], c[2]);
+}
+
+#if defined(__SSE2__)
+// Função que converte 8 pesos de 16 bits em 8 pixels RGBA do gradiente
+inline void corGradiente8(__m128i w, uint32_t* rgba) {
+    const __m128i inicioR = _mm_set1_epi16(GRADIENTE_INICIO[0]);
+    const __m128i inicioG = _mm_set1_epi16(GRADIENTE_INICIO[1]);
+    const __m128i inicioB = _mm_set1_epi16(GRADIENTE_INICIO[2]);
+    const __m128i deltaR = _mm_set1_epi16(2 * (GRADIENTE_FIM[0] - GRADIENTE_INICIO[0]));
+    const __m128i deltaG = _mm_set1_epi16(2 * (GRADIENTE_FIM[1] - GRADIENTE_INICIO[1]));
+    const __m128i deltaB = _mm_set1_epi16(2 * (GRADIENTE_FIM[2] - GRADIENTE_INICIO[2]));
+    __m128i r = _mm_add_epi16(inicioR, _mm_mulhi_epi16(deltaR, w));
+    __m128i g = _mm_add_epi16(inicioG, _mm_mulhi_epi16(deltaG, w));
+    __m128i b = _mm_add_epi16(inicioB, _mm_mulhi_epi16(deltaB, w));
+    // Intercala os canais: R G e B A em pares de bytes, depois em pixels
+    __m128i zero = _mm_setzero_si128();
+    __m128i r8 = _mm_packus_epi16(r, zero), g8 = _mm_packus_epi16(g, zero), b8 = _mm_packus_epi16(b, zero);
+    __m128i rg = _mm_unpacklo_epi8(r8, g8);
+    __m128i ba = _mm_unpacklo_epi8(b8, _mm_set1_epi8(static_cast<char>(0xFF)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + 4), _mm_unpackhi_epi16(rg, ba));
+}
+#endif
+
+// Função que preenche n pixels com uma mesma cor
+void faixaSolida(uint32_t cor, int n, uint32_t* rgba) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i c = _mm_set1_epi32(static_cast<int>(cor));
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i), c);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i + 4), c);
+    }
+#endif
+    for (; i < n; ++i) rgba[i] = cor;
+}
+
+// Os estilos usam apenas o estilo, a cor e o retangulo envolvente, e por isso aceitam
+// tanto uma forma quanto a sua copia imutavel usada pela thread de desenho
+
+// Gradiente linear: o peso avanca por um passo constante de ponto fixo 16.16
+template <typename F>
+void faixaLinear(const F& f, int xIni, int n, uint32_t* rgba) {
+    int largura = std::max(1, f.xMax - f.xMin);
+    int passo = static_cast<int>((static_cast<long long>(32767) << 16) / largura);
+    // O acumulador cabe em 32 bits dentro do retangulo envolvente; fora dele
+    // (faixas que o ultrapassam apos uma transformacao) o peso e saturado
+    auto acumulador = [&](int x) {
+        long long a = static_cast<long long>(x - f.xMin) * passo;
+        return static_cast<int>(std::max<long long>(0, std::min<long long>(a, 32767LL << 16)));
+    };
+    int i = 0;
+#if defined(__SSE2__)
+    // Com largura >= 8, o passo de 8 pixels cabe em 32 bits (passo <= 32767 << 13)
+    if (n >= 8 && largura >= 8 && xIni >= f.xMin && xIni + n - 1 <= f.xMax) {
+        // Acumuladores dos pixels 0..3 e 4..7 do grupo
+        __m128i a0 = _mm_add_epi32(_mm_set1_epi32(acumulador(xIni)), _mm_set_epi32(3 * passo, 2 * passo, passo, 0));
+        __m128i a1 = _mm_add_epi32(a0, _mm_set1_epi32(4 * passo));
+        __m128i avanco = _mm_set1_epi32(8 * passo);
+        for (; i + 8 <= n; i += 8) {
+            __m128i w = _mm_packs_epi32(_mm_srai_epi32(a0, 16), _mm_srai_epi32(a1, 16));
+            corGradiente8(w, rgba + i);
+            a0 = _mm_add_epi32(a0, avanco);
+            a1 = _mm_add_epi32(a1, avanco);
+        }
+    }
+#endif
+    for (; i < n; ++i) rgba[i] = corGradiente(acumulador(xIni + i) >> 16);
+}
+
+// Gradiente radial: o peso e a distancia ao centro, normalizada pela distancia aos cantos
+template <typename F>
+void faixaRadial(const F& f, int y, int xIni, int n, uint32_t* rgba) {
+    float cx = 0.5f * (f.xMin + f.xMax), cy = 0.5f * (f.yMin + f.yMax);
+    float raio = std::max(1.0f, std::sqrt((f.xMax - cx) * (f.xMax - cx) + (f.yMax - cy) * (f.yMax - cy)));
+    float escala = 32767.0f / raio;
+    float dy2 = (y - cy) * (y - cy);
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 dx0 = _mm_add_ps(_mm_set1_ps(xIni - cx), _mm_set_ps(3, 2, 1, 0));
+    __m128 dx1 = _mm_add_ps(dx0, _mm_set1_ps(4));
+    __m128 vdy2 = _mm_set1_ps(dy2), vescala = _mm_set1_ps(escala), avanco = _mm_set1_ps(8);
+    for (; i + 8 <= n; i += 8) {
+        __m128i w0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx0, dx0), vdy2)), vescala));
+        __m128i w1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx1, dx1), vdy2)), vescala));
+        corGradiente8(_mm_packs_epi32(w0, w1), rgba + i); // packs satura em 32767
+        dx0 = _mm_add_ps(dx0, avanco);
+        dx1 = _mm_add_ps(dx1, avanco);
+    }
+#endif
+    for (; i < n; ++i) {
+        float dx = (xIni - cx) + i;
+        int w = static_cast<int>(std::sqrt(dx * dx + dy2) * escala);
+        rgba[i] = corGradiente(std::min(w, 32767));
+    }
+}
+
+// Hachura diagonal em ladrilhos de 8x8 ancorados na origem do canvas: cada linha
+// se repete a cada 8 pixels, entao o periodo e avaliado uma vez e replicado
+void faixaPadrao(int y, int xIni, int n, uint32_t* rgba) {
+    alignas(16) uint32_t periodo[8];
+    uint32_t fundo = empacotarRGBA(HACHURA_FUNDO[0], HACHURA_FUNDO[1], HACHURA_FUNDO[2]);
+    uint32_t traco = empacotarRGBA(HACHURA_TRACO[0], HACHURA_TRACO[1], HACHURA_TRACO[2]);
+    for (int k = 0; k < 8; ++k) periodo[k] = (((xIni + k + y) & 7) < 2) ? traco : fundo;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i p0 = _mm_load_si128(reinterpret_cast<const __m128i*>(periodo));
+    __m128i p1 = _mm_load_si128(reinterpret_cast<const __m128i*>(periodo + 4));
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i), p0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i + 4), p1);
+    }
+#endif
+    for (; i < n; ++i) rgba[i] = periodo[i & 7];
+}
+
+// Função que avalia o estilo de preenchimento da forma nos pixels xIni..xFim da linha y
+template <typename F>
+void avaliarFaixa(const F& f, int y, int xIni, int xFim, uint32_t* rgba) {
+    int n = xFim - xIni + 1;
+    switch (f.estilo) {
+        case LINEAR: faixaLinear(f, xIni, n, rgba); break;
+        case RADIAL: faixaRadial(f, y, xIni, n, rgba); break;
+        case PADRAO: faixaPadrao(y, xIni, n, rgba); break;
+        default: faixaSolida(empacotarRGBA(f.cor[0], f.cor[1], f.cor[2]), n, rgba); break;
+    }
+}
+
+/*
+ * Instancias
+ * Uma instancia guarda apenas a matriz afim e a cor; a geometria fica na definicao
+ * compartilhada. O raster (contorno e preenchimento) de uma definicao depende so da
+ * parte linear da matriz, e e calculado uma vez para cada parte linear distinta:
+ * instancias com a mesma rotacao, escala e cisalhamento reutilizam o mesmo raster,
+ * deslocado pela translacao. Nos circulos a parte linear so altera o raio, pela
+ * raiz do determinante, como nas transformacoes de circulos comuns
+ */
+const size_t MAXIMO_RASTERS = 64; // rasters por definicao antes de descartar os sem uso
+
+// Função que obtem (calculando na primeira vez) o raster da definicao para a parte linear da matriz
+std::shared_ptr<const rasterDefinicao> rasterDe(definicao& d, const matriz3& matriz) {
+    std::array<long long, 4> chave = {std::llround(matriz[0][0] * 10000), std::llround(matriz[0][1] * 10000),
+                                      std::llround(matriz[1][0] * 10000), std::llround(matriz[1][1] * 10000)};
+    std::lock_guard<std::mutex> trava(d.mutex);
+    auto it = d.rasters.find(chave);
+    if (it != d.rasters.end()) return it->second;
+
+    // Forma temporaria com os vertices da definicao sob a parte linear
+    forma temporaria;
+    temporaria.tipo = d.tipo;
+    matriz3 linear = matriz;
+    linear[0][2] = linear[1][2] = 0;
+    // A rasterizacao e feita em torno da posicao original da definicao, e nao da
+    // origem local, para que os arredondamentos do preenchimento sejam os mesmos da
+    // forma que deu origem ao carimbo; dx, dy trazem o resultado de volta
+    int dx = -d.origem.x, dy = -d.origem.y;
+    if (d.tipo == CIR) {
+        // O circulo guarda apenas centro e raio: da parte linear so se aproveita a escala
+        // media sqrt(|det|), e sob escala nao uniforme ou cisalhamento a instancia continua
+        // um circulo, e nao vira uma elipse
+        float escala = std::sqrt(std::fabs(linear[0][0] * linear[1][1] - linear[0][1] * linear[1][0]));
+        int raio = static_cast<int>(d.v.front().x * escala);
+        temporaria.v.push_front(d.origem);
+        temporaria.v.push_front({raio, raio});
+    } else {
+        std::vector<vertice> vertices;
+        for (const auto& vert : d.v) {
+            vertice transformado = aplicarTransformacao(vert, linear);
+            vertices.push_back({transformado.x - dx, transformado.y - dy});
+        }
+        temporaria.v.assign(vertices.begin(), vertices.end());
+    }
+
+    auto raster = std::make_shared<rasterDefinicao>();
+    bool vazio = true;
+    auto anotar = [&](int y, int xIni, int xFim) {
+        if (vazio) {
+            raster->xMin = xIni;
+            raster->xMax = xFim;
+            raster->yMin = raster->yMax = y;
+            vazio = false;
+            return;
+        }
+        raster->xMin = std::min(raster->xMin, xIni);
+        raster->yMin = std::min(raster->yMin, y);
+        raster->xMax = std::max(raster->xMax, xFim);
+        raster->yMax = std::max(raster->yMax, y);
+    };
+    rasterizarContorno(temporaria, [&](int y, int xIni, int xFim) {
+        anotar(y + dy, xIni + dx, xFim + dx);
+        raster->contorno.push_back({y + dy, xIni + dx, xFim + dx});
+    });
+    // Sem transformacao linear vale o preenchimento original, identico ao da forma que
+    // deu origem ao carimbo; nas demais o preenchimento e refeito pelos vertices, como
+    // nas transformacoes das formas comuns
+    bool identidade = chave == std::array<long long, 4>{10000, 0, 0, 10000};
+    if (d.preenchido && identidade && d.preenchimentoOriginal) {
+        for (const auto& fx : d.preenchimentoOriginal->faixas) {
+            anotar(fx.y, fx.xIni, fx.xFim);
+            raster->preenchimento.push_back(fx);
+        }
+    } else if (d.preenchido) {
+        if (d.tipo == CIR) preencherCirculo(temporaria);
+        else preencherPoligono(temporaria);
+        for (const auto& fx : temporaria.faixas) {
+            anotar(fx.y + dy, fx.xIni + dx, fx.xFim + dx);
+            raster->preenchimento.push_back({fx.y + dy, fx.xIni + dx, fx.xFim + dx});
+        }
+    }
+    // Ordenadas por linha, para que cada ladrilho ache as suas por busca binaria
+    auto porLinha = [](const faixa& a, const faixa& b) { return a.y < b.y; };
+    std::sort(raster->contorno.begin(), raster->contorno.end(), porLinha);
+    std::sort(raster->preenchimento.begin(), raster->preenchimento.end(), porLinha);
+
+    // Descarta os rasters que nenhuma instancia usa mais
+    if (d.rasters.size() >= MAXIMO_RASTERS) {
+        for (auto r = d.rasters.begin(); r != d.rasters.end(); ) {
+            if (r->second.use_count() == 1) r = d.rasters.erase(r);
+            else ++r;
+        }
+    }
+    d.rasters[chave] = raster;
+    return raster;
+}
+
+// Função que atualiza o raster de uma instancia apos mudar sua matriz
+void atualizarRaster(forma& f) {
+    f.raster = rasterDe(*f.def, f.matriz);
+}
+
+// Função para armazenar uma instancia da definicao na lista de formas
+forma& pushInstancia(const std::shared_ptr<definicao>& def, const matriz3& matriz, const int cor[3]) {
+    pushForma(INST);
+    forma& f = formas.front();
+    f.def = def;
+    f.matriz = matriz;
+    f.preenchido = def->preenchido;
+    f.estilo = def->estilo;
+    for (int i = 0; i < 3; ++i) f.cor[i] = cor[i];
+    atualizarRaster(f);
+    return f;
+}
+
+// Função que transforma uma forma em carimbo: a geometria passa para uma nova
+// definicao e a propria forma vira a primeira instancia dela
+// Uma instancia apenas passa a ser o carimbo, pois ja compartilha a sua definicao
+bool criarCarimbo(forma& f) {
+    if (f.tipo == INST) {
+        carimbo.def = f.def;
+        carimbo.matriz = f.matriz;
+        for (int i = 0; i < 3; ++i) carimbo.cor[i] = f.cor[i];
+        return true;
+    }
+    if (f.v.empty()) return false;
+
+    // O pivo (nos circulos, o centro) vira a origem da definicao
+    std::vector<forma*> origem = {&f};
+    vertice pivo = calcularPivo(origem);
+    auto def = std::make_shared<definicao>();
+    def->id = proximaDefinicao++;
+    def->tipo = f.tipo;
+    def->preenchido = f.preenchido;
+    def->estilo = f.estilo;
+    def->origem = pivo;
+    std::vector<vertice> locais;
+    for (const auto& vert : f.v) locais.push_back(vert);
+    // No circulo o raio, primeiro vertice, nao e uma posicao
+    for (size_t i = f.tipo == CIR ? 1 : 0; i < locais.size(); ++i) {
+        locais[i].x -= pivo.x;
+        locais[i].y -= pivo.y;
+    }
+    def->v.assign(locais.begin(), locais.end());
+    if (f.preenchido) {
+        auto preenchimento = std::make_shared<pedacoForma>();
+        for (const auto& fx : abrirFaixas(f)) preenchimento->faixas.push_back({fx.y - pivo.y, fx.xIni - pivo.x, fx.xFim - pivo.x});
+        def->preenchimentoOriginal = std::move(preenchimento);
+    }
+
+    f.tipo = INST;
+    f.def = def;
+    f.matriz = criarMatrizTranslacao(pivo.x, pivo.y);
+    f.v.clear();
+    f.faixas.clear();
+    f.faixasAbertas = false;
+    atualizarRaster(f);
+    indexarForma(f);
+
+    carimbo.def = def;
+    carimbo.matriz = f.matriz;
+    for (int i = 0; i < 3; ++i) carimbo.cor[i] = f.cor[i];
+    return true;
+}
+
+/*
+ * Captura de quadros
+ * Cada quadro concluido e lido do back buffer, logo antes da troca, para um de
+ * dois pixel buffer objects (PBO). A leitura e assincrona: o quadro N so e mapeado
+ * durante o quadro N+1, quando a copia ja terminou, e entao passa para um buffer
+ * livre que a thread de gravacao converte para YUV 4:4:4 e acrescenta ao arquivo
+ * Y4M. Se a gravacao nao acompanhar e nao houver buffer livre, o quadro e perdido
+ * e contado.
+ * A janela so e redesenhada quando algo muda, e por isso o video e amostrado a uma
+ * taxa fixa pelo relogio: cada redesenho leva o instante em que foi lido, e a thread
+ * de gravacao repete o quadro anterior ate esse instante. Nas pausas o ultimo quadro
+ * fica na tela pelo tempo que ficou na janela; em rajadas, so o mais recente de cada
+ * intervalo de amostragem entra no video. Um quadro perdido apenas prolonga o anterior
+ */
+const int BUFFERS_CAPTURA = 8; // quadros que podem aguardar a thread de gravacao
+const int QUADROS_POR_SEGUNDO_CAPTURA = 30; // taxa de amostragem do video
+
+struct estadoCaptura{
+    bool ativa = false;
+    int largura = 0, altura = 0;
+    GLuint pbo[2] = {0, 0};
+    bool pendente[2] = {false, false}; // PBO com uma leitura ainda nao coletada
+    std::chrono::steady_clock::time_point lido[2]; // instante da leitura de cada PBO
+    int proximo = 0; // PBO que recebe a proxima leitura
+    size_t perdidos = 0;
+    std::atomic<size_t> gravados{0}; // quadros do video, contando as repeticoes
+
+    // Fila da thread de gravacao (buffers BGRA de largura * altura * 4 bytes)
+    std::mutex mutex;
+    std::condition_variable sinal;
+    std::vector<std::vector<uint8_t>> livres, cheios;
+    std::vector<std::chrono::steady_clock::time_point> instantes; // de cada buffer em cheios
+    std::chrono::steady_clock::time_point inicio, fim; // da captura; fim vale ao encerrar
+    bool encerrar = false;
+    std::thread thread;
+    FILE* arquivo = nullptr;
+} captura;
+
+// Laco da thread de gravacao: converte cada quadro para Y4M (BT.601, faixa limitada)
+void gravarCaptura() {
+    const int w = captura.largura, h = captura.altura;
+    std::vector<uint8_t> planos(3 * static_cast<size_t>(w) * h);
+    uint8_t* planoY = planos.data();
+    uint8_t* planoU = planoY + static_cast<size_t>(w) * h;
+    uint8_t* planoV = planoU + static_cast<size_t>(w) * h;
+    // Indice, na taxa de amostragem, do intervalo em que cai o instante t
+    auto intervalo = [](std::chrono::steady_clock::time_point t) {
+        return static_cast<long long>(std::chrono::duration<double>(t - captura.inicio).count() * QUADROS_POR_SEGUNDO_CAPTURA);
+    };
+    // Os planos guardam o quadro do intervalo atual, ainda nao gravado; gravarAte o
+    // repete ate o intervalo n, exclusive
+    long long atual = -1;
+    auto gravarAte = [&](long long n) {
+        if (atual < 0) return;
+        for (; atual < n; ++atual) {
+            fputs("FRAME\n", captura.arquivo);
+            fwrite(planos.data(), 1, planos.size(), captura.arquivo);
+            captura.gravados++;
+        }
+    };
+    while (true) {
+        std::vector<uint8_t> quadro;
+        std::chrono::steady_clock::time_point instante;
+        bool terminou = false;
+        {
+            std::unique_lock<std::mutex> trava(captura.mutex);
+            captura.sinal.wait(trava, [] { return captura.encerrar || !captura.cheios.empty(); });
+            terminou = captura.cheios.empty(); // encerrando e sem quadros na fila
+            if (terminou) {
+                instante = captura.fim;
+            } else {
+                quadro = std::move(captura.cheios.front());
+                captura.cheios.erase(captura.cheios.begin());
+                instante = captura.instantes.front();
+                captura.instantes.erase(captura.instantes.begin());
+            }
+        }
+        if (terminou) {
+            // O ultimo quadro fica ate o fim da captura
+            gravarAte(std::max(atual + 1, intervalo(instante)));
+            break;
+        }
+        // O quadro anterior cobre os intervalos ate este; no mesmo intervalo, e substituido
+        long long n = intervalo(instante);
+        gravarAte(n);
+        atual = std::max(atual, n);
+        // O OpenGL entrega as linhas de baixo para cima
+        for (int y = 0; y < h; ++y) {
+            const uint8_t* bgra = quadro.data() + static_cast<size_t>(h - 1 - y) * w * 4;
+            size_t base = static_cast<size_t>(y) * w;
+            for (int x = 0; x < w; ++x, bgra += 4) {
+                int b = bgra[0], g = bgra[1], r = bgra[2];
+                planoY[base + x] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                planoU[base + x] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                planoV[base + x] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> trava(captura.mutex);
+            captura.livres.push_back(std::move(quadro));
+        }
+    }
+}
+
+// Encerra a thread de gravacao depois que a fila esvazia (tambem chamada ao sair)
+void encerrarGravacaoCaptura() {
+    if (!captura.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> trava(captura.mutex);
+        captura.encerrar = true;
+        captura.fim = std::chrono::steady_clock::now();
+    }
+    captura.sinal.notify_one();
+    captura.thread.join();
+    fclose(captura.arquivo);
+    captura.arquivo = nullptr;
+}
+
+// Função que inicia a captura com o tamanho atual da janela
+void iniciarCaptura() {
+    if (captura.ativa || semJanela) return;
+    captura.arquivo = fopen(arquivoCaptura, "wb");
+    if (!captura.arquivo) {
+        fprintf(stderr, "Nao foi possivel criar %s\n", arquivoCaptura);
+        return;
+    }
+    captura.largura = width;
+    captura.altura = height;
+    fprintf(captura.arquivo, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, QUADROS_POR_SEGUNDO_CAPTURA);
+
+    size_t bytes = static_cast<size_t>(width) * height * 4;
+    glGenBuffers(2, captura.pbo);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, captura.pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        captura.pendente[i] = false;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    captura.livres.assign(BUFFERS_CAPTURA, std::vector<uint8_t>(bytes));
+    captura.cheios.clear();
+    captura.cheios.reserve(BUFFERS_CAPTURA);
+    captura.instantes.clear();
+    captura.instantes.reserve(BUFFERS_CAPTURA);
+    captura.inicio = std::chrono::steady_clock::now();
+    captura.proximo = 0;
+    captura.perdidos = 0;
+    captura.gravados = 0;
+    captura.encerrar = false;
+    captura.thread = std::thread(gravarCaptura);
+
+    static bool registrada = false;
+    if (!registrada) {
+        atexit(encerrarGravacaoCaptura);
+        registrada = true;
+    }
+    captura.ativa = true;
+    printf("Capturando quadros em %s\n", arquivoCaptura);
+}
+
+// Função que copia a leitura ja concluida de um PBO para um buffer livre
+void coletarPBO(int i) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, captura.pbo[i]);
+    const void* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels) {
+        std::lock_guard<std::mutex> trava(captura.mutex);
+        if (captura.livres.empty()) {
+            captura.perdidos++; // a gravacao esta atrasada
+        } else {
+            std::vector<uint8_t> quadro = std::move(captura.livres.back());
+            captura.livres.pop_back();
+            memcpy(quadro.data(), pixels, quadro.size());
+            captura.cheios.push_back(std::move(quadro));
+            captura.instantes.push_back(captura.lido[i]);
+            captura.sinal.notify_one();
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        captura.perdidos++;
+    }
+    captura.pendente[i] = false;
+}
+
+// Função que termina a captura, coletando a ultima leitura e esperando a gravacao
+void pararCaptura() {
+    if (!captura.ativa) return;
+    // A leitura mais antiga ainda pendente e a do proximo PBO a ser reutilizado
+    for (int k = 0; k < 2; ++k) {
+        int i = (captura.proximo + k) % 2;
+        if (captura.pendente[i]) coletarPBO(i);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteBuffers(2, captura.pbo);
+    encerrarGravacaoCaptura();
+    captura.livres.clear();
+    captura.livres.shrink_to_fit();
+    captura.ativa = false;
+    printf("Captura encerrada: %zu quadros gravados em %s, %zu perdidos\n",
+           captura.gravados.load(), arquivoCaptura, captura.perdidos);
+}
+
+bool capturandoQuadros() {
+    return captura.ativa;
+}
+
+void alternarCaptura() {
+    if (captura.ativa) pararCaptura();
+    else iniciarCaptura();
+    pedirRedesenho();
+}
+
+// Função chamada com o quadro concluido, antes da troca de buffers e com a projecao da janela
+void capturarQuadro() {
+    if (width != captura.largura || height != captura.altura) {
+        // Um arquivo Y4M tem um unico tamanho de quadro
+        pararCaptura();
+        return;
+    }
+    int i = captura.proximo;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, captura.pbo[i]);
+    glReadBuffer(GL_BACK);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, captura.largura, captura.altura, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    captura.pendente[i] = true;
+    captura.lido[i] = std::chrono::steady_clock::now();
+    captura.proximo = 1 - i;
+    // A leitura do quadro anterior ja teve um quadro inteiro para terminar
+    if (captura.pendente[captura.proximo]) coletarPBO(captura.proximo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // O indicador e desenhado depois da leitura e nao aparece no video
+    char linha[64];
+    snprintf(linha, sizeof(linha), "REC %zu quadros, %zu perdidos", captura.gravados.load(), captura.perdidos);
+    glColor3ub(255, 0, 0);
+    draw_text_stroke(0, height - 15, linha, 0.1);
+}
+
+/*
+ * Desenho em thread separada
+ * A thread da interface nao rasteriza as formas: a cada alteracao da cena ou da
+ * camera ela publica uma cena imutavel com as formas visiveis, e uma thread de
+ * desenho a rasteriza, faixa a faixa, em uma imagem na memoria. O quadro pronto e
+ * apenas copiado para a janela com glDrawPixels, com a previa e a selecao por cima.
+ * A cena publicada e a lista das copias imutaveis dos ladrilhos visiveis, e e
+ * compartilhada entre as versoes: um ladrilho so e copiado de novo quando a sua
+ * lista muda, uma forma so e copiada de novo quando ela muda, e a copia de uma
+ * forma compartilha os seus pedacos imutaveis, como as instancias compartilham o
+ * raster da definicao, sem copiar nenhuma faixa. Publicar uma cena custa assim o numero de
+ * ladrilhos visiveis mais o que mudou; juntar as formas dos ladrilhos sem repeticao
+ * e ordena-las fica para a thread de desenho. Cada versao e liberada quando a ultima
+ * thread que a usa a solta (shared_ptr)
+ */
+struct formaInstantanea{
+    int id;
+    unsigned long versao; // editadaEm da forma quando foi copiada
+    int estilo;
+    bool preenchido;
+    int cor[3];
+    int xMin, yMin, xMax, yMax;
+    std::shared_ptr<const listaPedacos> pedacos; // formas comuns: os pedacos imutaveis da forma
+    std::shared_ptr<const rasterDefinicao> raster; // instancias, deslocado por dx, dy
+    int dx = 0, dy = 0;
+};
+
+struct cenaInstantanea{
+    unsigned long versao;
+    double camX, camY, zoom;
+    int largura, altura;
+    std::vector<std::shared_ptr<const listaInstantanea>> ladrilhos; // ladrilhos visiveis
+};
+
+// Imagem desenhada pela thread, com as linhas de baixo para cima como no OpenGL
+struct quadroDesenhado{
+    std::vector<uint32_t> pixels; // RGBA
+    int largura = 0, altura = 0;
+};
+
+struct estadoDesenho{
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable sinal;
+    std::shared_ptr<const cenaInstantanea> pendente; // ultima cena publicada ainda nao desenhada
+    quadroDesenhado pronto; // ultimo quadro concluido
+    bool novo = false; // pronto ainda nao foi exibido
+    bool encerrar = false;
+
+    // Thread da interface
+    quadroDesenhado exibido;
+    unsigned long versaoPublicada = 0;
+    double camX = 0, camY = 0, zoom = 0;
+    int largura = 0, altura = 0;
+    bool verificando = false; // temporizador que verifica se ha quadro novo
+} desenho;
+
+// Função que copia uma forma para a cena publicada, reaproveitando a copia anterior se ela nao mudou
+std::shared_ptr<const formaInstantanea> instantaneaDe(forma& f) {
+    if (f.instantanea && f.instantanea->versao == f.editadaEm) return f.instantanea;
+    auto copia = std::make_shared<formaInstantanea>();
+    copia->id = f.id;
+    copia->versao = f.editadaEm;
+    copia->estilo = f.estilo;
+    copia->preenchido = f.preenchido;
+    for (int i = 0; i < 3; ++i) copia->cor[i] = f.cor[i];
+    copia->xMin = f.xMin;
+    copia->yMin = f.yMin;
+    copia->xMax = f.xMax;
+    copia->yMax = f.yMax;
+    if (f.tipo == INST) {
+        copia->raster = f.raster;
+        copia->dx = std::lround(f.matriz[0][2]);
+        copia->dy = std::lround(f.matriz[1][2]);
+    } else {
+        copia->pedacos = f.pedacos;
+    }
+    f.instantanea = copia;
+    return copia;
+}
+
+// Função que publica uma nova versao da cena se a cena, a camera ou a janela mudaram
+void publicarCena() {
+    if (desenho.versaoPublicada == versaoCena && desenho.camX == camX && desenho.camY == camY &&
+        desenho.zoom == zoom && desenho.largura == width && desenho.altura == height) {
+        return;
+    }
+    auto cena = std::make_shared<cenaInstantanea>();
+    cena->versao = versaoCena;
+    cena->camX = camX;
+    cena->camY = camY;
+    cena->zoom = zoom;
+    cena->largura = width;
+    cena->altura = height;
+    int vxMin = static_cast<int>(std::floor(camX)), vyMin = static_cast<int>(std::floor(camY));
+    int vxMax = static_cast<int>(std::ceil(camX + width / zoom));
+    int vyMax = static_cast<int>(std::ceil(camY + height / zoom));
+    percorrerLadrilhos(vxMin, vyMin, vxMax, vyMax, [&](ladrilho& t, int, int) {
+        if (!t.instantanea || t.versaoInstantanea != t.versao) {
+            auto lista = std::make_shared<listaInstantanea>();
+            lista->reserve(t.formas.size());
+            for (const auto& e : t.formas) lista->push_back(instantaneaDe(*e.f));
+            t.instantanea = std::move(lista);
+            t.versaoInstantanea = t.versao;
+        }
+        cena->ladrilhos.push_back(t.instantanea);
+    });
+
+    desenho.versaoPublicada = versaoCena;
+    desenho.camX = camX;
+    desenho.camY = camY;
+    desenho.zoom = zoom;
+    desenho.largura = width;
+    desenho.altura = height;
+    {
+        std::lock_guard<std::mutex> trava(desenho.mutex);
+        desenho.pendente = std::move(cena); // uma cena ainda nao desenhada e descartada
+    }
+    desenho.sinal.notify_one();
+}
+
+// Função que pinta os pixels xIni..xFim da linha y do canvas na imagem, com a cor
+// unica cor ou, se rgba nao for nulo, com uma cor por pixel do canvas
+// Um pixel do canvas cobre os pixels da janela cujo centro cai dentro dele, como no OpenGL
+void pintarFaixa(const cenaInstantanea& cena, quadroDesenhado& quadro, int y, int xIni, int xFim,
+                 uint32_t cor, const uint32_t* rgba) {
+    auto primeiraColuna = [&](double c) { return static_cast<int>(std::ceil(c - 0.5)); };
+    int linhaIni = std::max(0, primeiraColuna((y - cena.camY) * cena.zoom));
+    int linhaFim = std::min(quadro.altura, primeiraColuna((y + 1 - cena.camY) * cena.zoom));
+    if (linhaIni >= linhaFim) return;
+    int colunaIni = std::max(0, primeiraColuna((xIni - cena.camX) * cena.zoom));
+    int colunaFim = std::min(quadro.largura, primeiraColuna((xFim + 1 - cena.camX) * cena.zoom));
+    if (colunaIni >= colunaFim) return;
+    for (int linha = linhaIni; linha < linhaFim; ++linha) {
+        uint32_t* destino = quadro.pixels.data() + static_cast<size_t>(linha) * quadro.largura;
+        if (!rgba) {
+            std::fill(destino + colunaIni, destino + colunaFim, cor);
+            continue;
+        }
+        // Cada coluna da janela recebe a cor do pixel do canvas que a contem
+        for (int coluna = colunaIni; coluna < colunaFim; ++coluna) {
+            int x = static_cast<int>(std::floor(cena.camX + (coluna + 0.5) / cena.zoom));
+            destino[coluna] = rgba[std::min(std::max(x, xIni), xFim) - xIni];
+        }
+    }
+}
+
+// Função que rasteriza uma cena publicada na imagem, com as mesmas cores de desenharForma
+void desenharCena(const cenaInstantanea& cena, quadroDesenhado& quadro) {
+    quadro.largura = cena.largura;
+    quadro.altura = cena.altura;
+    quadro.pixels.assign(static_cast<size_t>(quadro.largura) * quadro.altura, empacotarRGBA(255, 255, 255));
+    uint32_t contorno = empacotarRGBA(preto[0], preto[1], preto[2]);
+    // Regiao do canvas visivel, para recortar as faixas com estilo antes de avalia-las
+    int vxMin = static_cast<int>(std::floor(cena.camX)), vyMin = static_cast<int>(std::floor(cena.camY));
+    int vxMax = static_cast<int>(std::ceil(cena.camX + cena.largura / cena.zoom));
+    int vyMax = static_cast<int>(std::ceil(cena.camY + cena.altura / cena.zoom));
+    escopoRascunho escopo;
+    std::pmr::vector<uint32_t> linha(escopo.recurso());
+
+    // Formas que cruzam a janela, sem repeticao e na mesma ordem de drawFormas
+    std::pmr::vector<const formaInstantanea*> formasVisiveis(escopo.recurso());
+    for (const auto& lista : cena.ladrilhos) {
+        for (const auto& f : *lista) {
+            if (f->xMax >= vxMin && f->xMin <= vxMax && f->yMax >= vyMin && f->yMin <= vyMax) {
+                formasVisiveis.push_back(f.get());
+            }
+        }
+    }
+    std::sort(formasVisiveis.begin(), formasVisiveis.end(), [](const formaInstantanea* a, const formaInstantanea* b) {
+        return a->id > b->id;
+    });
+    formasVisiveis.erase(std::unique(formasVisiveis.begin(), formasVisiveis.end()), formasVisiveis.end());
+
+    // Desenha o contorno e depois o preenchimento de um conjunto de faixas da forma
+    auto desenharFaixas = [&](const formaInstantanea& f, const faixa* faixasContorno, size_t nContorno,
+                              const faixa* faixasPreenchidas, size_t nPreenchidas) {
+        int dx = f.dx, dy = f.dy;
+        for (size_t i = 0; i < nContorno; ++i) {
+            const faixa& fx = faixasContorno[i];
+            pintarFaixa(cena, quadro, fx.y + dy, fx.xIni + dx, fx.xFim + dx, contorno, nullptr);
+        }
+        if (f.estilo == SOLIDO) {
+            uint32_t cor = empacotarRGBA(f.cor[0], f.cor[1], f.cor[2]);
+            for (size_t i = 0; i < nPreenchidas; ++i) {
+                const faixa& fx = faixasPreenchidas[i];
+                pintarFaixa(cena, quadro, fx.y + dy, fx.xIni + dx, fx.xFim + dx, cor, nullptr);
+            }
+        } else if (f.preenchido) {
+            for (size_t i = 0; i < nPreenchidas; ++i) {
+                const faixa& fx = faixasPreenchidas[i];
+                int y = fx.y + dy;
+                int xIni = std::max(fx.xIni + dx, vxMin), xFim = std::min(fx.xFim + dx, vxMax);
+                if (y < vyMin || y > vyMax || xIni > xFim) continue;
+                linha.resize(xFim - xIni + 1);
+                avaliarFaixa(f, y, xIni, xFim, linha.data());
+                pintarFaixa(cena, quadro, y, xIni, xFim, 0, linha.data());
+            }
+        }
+    };
+    for (const formaInstantanea* f : formasVisiveis) {
+        if (f->raster) {
+            desenharFaixas(*f, f->raster->contorno.data(), f->raster->contorno.size(),
+                           f->raster->preenchimento.data(), f->raster->preenchimento.size());
+        } else if (f->pedacos) {
+            // Cada pedaco so tem pixels do seu ladrilho, e a ordem entre eles nao importa
+            for (const auto& p : *f->pedacos) {
+                desenharFaixas(*f, p->faixas.data(), p->nContorno,
+                               p->faixas.data() + p->nContorno, p->faixas.size() - p->nContorno);
+            }
+        }
+    }
+}
+
+// Laco da thread de desenho: desenha sempre a cena publicada mais recente
+void desenharEmThread() {
+    quadroDesenhado quadro;
+    while (true) {
+        std::shared_ptr<const cenaInstantanea> cena;
+        {
+            std::unique_lock<std::mutex> trava(desenho.mutex);
+            desenho.sinal.wait(trava, [] { return desenho.encerrar || desenho.pendente; });
+            if (desenho.encerrar) break;
+            cena.swap(desenho.pendente);
+        }
+        desenharCena(*cena, quadro);
+        cena.reset(); // libera a versao, se a interface ja publicou outra
+        std::lock_guard<std::mutex> trava(desenho.mutex);
+        std::swap(quadro, desenho.pronto);
+        desenho.novo = true;
+    }
+}
+
+void encerrarDesenhoEmThread() {
+    if (!desenho.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> trava(desenho.mutex);
+        desenho.encerrar = true;
+    }
+    desenho.sinal.notify_one();
+    desenho.thread.join();
+}
+
+// Temporizador da thread da interface: pede um redesenho quando ha quadro novo
+// (o GLUT so pode ser chamado pela thread que o iniciou)
+void verificarQuadroDesenhado(int valor) {
+    if (!desenhoEmThread) {
+        desenho.verificando = false;
+        return;
+    }
+    bool novo;
+    {
+        std::lock_guard<std::mutex> trava(desenho.mutex);
+        novo = desenho.novo;
+    }
+    if (novo) pedirRedesenho();
+    glutTimerFunc(INTERVALO_VERIFICAR_DESENHO, verificarQuadroDesenhado, valor);
+}
+
+void iniciarDesenhoEmThread() {
+    if (semJanela) return;
+    if (!desenho.thread.joinable()) {
+        desenho.thread = std::thread(desenharEmThread);
+        atexit(encerrarDesenhoEmThread);
+    }
+    if (!desenho.verificando) {
+        desenho.verificando = true;
+        glutTimerFunc(INTERVALO_VERIFICAR_DESENHO, verificarQuadroDesenhado, 0);
+    }
+    // Forca a publicacao da cena atual
+    desenho.versaoPublicada = ULONG_MAX;
+}
+
+// Função chamada por display(): publica a cena e exibe o ultimo quadro pronto
+void exibirDesenhoEmThread() {
+    publicarCena();
+    {
+        std::lock_guard<std::mutex> trava(desenho.mutex);
+        if (desenho.novo) {
+            std::swap(desenho.exibido, desenho.pronto);
+            desenho.novo = false;
+        }
+    }
+    if (desenho.exibido.largura > 0) {
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0, width, 0, height, -1, 1);
+        glMatrixMode(GL_MODELVIEW);
+        glPixelZoom(1, 1);
+        glRasterPos2i(0, 0);
+        glDrawPixels(desenho.exibido.largura, desenho.exibido.altura, GL_RGBA, GL_UNSIGNED_BYTE,
+                     desenho.exibido.pixels.data());
+        glPixelZoom(zoom, zoom);
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+    }
+
+    // O que acompanha o mouse e desenhado direto, com a cena atual
+    desenharPrevia();
+    desenharSelecao();
+}
+
+/*
+ * Ingestao de comandos por socket local
+ * Ferramentas locais podem enviar formas e transformacoes por um socket de dominio
+ * Unix (--socket caminho). Uma thread recebe os lotes, valida e os enfileira; a
+ * thread da interface os aplica em bloco uma vez por quadro, dentro de um orcamento
+ * de tempo, e o que nao couber fica para o quadro seguinte. Se a fila crescer
+ * demais, a thread deixa de ler os clientes, que entao esperam no proprio envio.
+ *
+ * Protocolo (palavras de 32 bits na ordem de bytes da maquina):
+ *   lote:  n, seguido de n palavras de comandos
+ *   1  LIN   x1 y1 x2 y2
+ *   2  TRI   x1 y1 x2 y2 x3 y3
+ *   3  QUAD  x1 y1 x2 y2              (cantos opostos)
+ *   4  POL   nv x1 y1 ... xnv ynv     (nv >= 4)
+ *   6  CIR   x y raio
+ *   16 PREENCHER  k r g b estilo
+ *   17 TRANSLADAR k dx dy             (float)
+ *   18 ESCALAR    k fator             (float)
+ *   19 ROTACIONAR k graus             (float)
+ *   20 CISALHAR   k dx dy             (float)
+ *   21 REFLETIR   k vertical horizontal
+ * Os codigos das formas sao os de tipo_forma. Os comandos 16 a 21 se aplicam as k
+ * formas mais recentes ou, com k = 0, a selecao (ou a ultima forma), como no teclado
+ * Lotes com argumentos fora dos limites abaixo (LIMITE_*) sao invalidos
+ */
+#if defined(__unix__) || defined(__APPLE__)
+enum comando_ingestao{PREENCHER = 16, TRANSLADAR, ESCALAR, ROTACIONAR, CISALHAR, REFLETIR };
+const size_t MAXIMO_LOTE = 1 << 24; // palavras por lote
+const size_t LIMITE_FILA_INGESTAO = 1 << 24; // palavras enfileiradas antes de parar de ler
+const double ORCAMENTO_INGESTAO = 4.0; // ms de aplicacao de comandos por quadro
+const size_t LOTE_INDEXACAO = 1024; // formas pendentes indexadas de uma vez
+// Limites dos argumentos: coordenadas e deslocamentos em modulo, raio, fator de escala
+// (e seu inverso), angulo e cisalhamento em modulo, e area do retangulo envolvente de
+// uma forma preenchida. Mantem as contas dos rasterizadores dentro de int, e o custo
+// de contornos, preenchimentos e da indexacao limitado, mesmo apos varias transformacoes
+const int32_t LIMITE_COORDENADA = 1 << 18;
+const int32_t LIMITE_RAIO = 1 << 14;
+const double LIMITE_AREA_PREENCHIDA = double(1 << 14) * (1 << 14);
+const float LIMITE_ESCALA = 64, LIMITE_ANGULO = 360, LIMITE_CISALHAMENTO = 16;
+
+struct estadoIngestao{
+    std::thread thread;
+    std::mutex mutex;
+    std::vector<std::vector<int32_t>> lotes; // validados, na ordem de chegada
+    size_t palavras = 0; // total enfileirado
+    bool encerrar = false;
+    int servidor = -1;
+
+    // Thread da interface: lote em aplicacao e posicao nele
+    std::vector<std::vector<int32_t>> aplicando;
+    size_t lote = 0, posicao = 0;
+} ingestao;
+
+// Número de palavras do comando que comeca em c (inclusive o codigo), ou 0 se invalido
+size_t tamanhoComando(const int32_t* c, size_t restantes) {
+    switch (c[0]) {
+        case LIN: return 5;
+        case TRI: return 7;
+        case QUAD: return 5;
+        case CIR: return 4;
+        case POL: {
+            if (restantes < 2 || c[1] < 4 || static_cast<size_t>(c[1]) > (restantes - 2) / 2) return 0;
+            return 2 + 2 * static_cast<size_t>(c[1]);
+        }
+        case PREENCHER: return 6;
+        case TRANSLADAR: return 4;
+        case ESCALAR: return 3;
+        case ROTACIONAR: return 3;
+        case CISALHAR: return 4;
+        case REFLETIR: return 4;
+        default: return 0;
+    }
+}
+
+// Função que le uma palavra de comando como float
+inline float palavraFloat(int32_t palavra) {
+    float valor;
+    memcpy(&valor, &palavra, sizeof(valor));
+    return valor;
+}
+
+// Função que valida os argumentos de um comando de n palavras
+bool argumentosValidos(const int32_t* c, size_t n) {
+    auto coordenadas = [&](size_t ini, size_t fim) {
+        for (size_t j = ini; j < fim; ++j) {
+            if (c[j] < -LIMITE_COORDENADA || c[j] > LIMITE_COORDENADA) return false;
+        }
+        return true;
+    };
+    // Falso tambem para NaN
+    auto real = [&](size_t j, float minimo, float maximo) {
+        float valor = palavraFloat(c[j]);
+        return valor >= minimo && valor <= maximo;
+    };
+    float limite = static_cast<float>(LIMITE_COORDENADA);
+    switch (c[0]) {
+        case LIN: case TRI: case QUAD: return coordenadas(1, n);
+        case POL: return coordenadas(2, n);
+        case CIR: return coordenadas(1, 3) && c[3] >= 0 && c[3] <= LIMITE_RAIO;
+        case PREENCHER: return c[1] >= 0;
+        case TRANSLADAR: return c[1] >= 0 && real(2, -limite, limite) && real(3, -limite, limite);
+        case ESCALAR: return c[1] >= 0 && real(2, 1 / LIMITE_ESCALA, LIMITE_ESCALA);
+        case ROTACIONAR: return c[1] >= 0 && real(2, -LIMITE_ANGULO, LIMITE_ANGULO);
+        case CISALHAR: {
+            return c[1] >= 0 && real(2, -LIMITE_CISALHAMENTO, LIMITE_CISALHAMENTO) &&
+                   real(3, -LIMITE_CISALHAMENTO, LIMITE_CISALHAMENTO);
+        }
+        case REFLETIR: return c[1] >= 0;
+        default: return false;
+    }
+}
+
+// Função que valida um lote inteiro antes de enfileira-lo
+bool loteValido(const std::vector<int32_t>& lote) {
+    for (size_t i = 0; i < lote.size(); ) {
+        size_t n = tamanhoComando(&lote[i], lote.size() - i);
+        if (n == 0 || n > lote.size() - i) return false;
+        if (!argumentosValidos(&lote[i], n)) return false;
+        i += n;
+    }
+    return true;
+}
+
+// Dados recebidos de um cliente que ainda nao formam um lote completo
+struct clienteIngestao{
+    int fd;
+    std::vector<uint8_t> recebido;
+};
+
+// Função que separa os lotes completos recebidos de um cliente; devolve false se algum for invalido
+bool extrairLotes(clienteIngestao& c) {
+    size_t inicio = 0;
+    bool valido = true;
+    while (c.recebido.size() - inicio >= 4) {
+        uint32_t n;
+        memcpy(&n, c.recebido.data() + inicio, 4);
+        if (n > MAXIMO_LOTE) {
+            valido = false;
+            break;
+        }
+        size_t bytes = 4 + static_cast<size_t>(n) * 4;
+        if (c.recebido.size() - inicio < bytes) break;
+        std::vector<int32_t> lote(n);
+        memcpy(lote.data(), c.recebido.data() + inicio + 4, static_cast<size_t>(n) * 4);
+        inicio += bytes;
+        if (!loteValido(lote)) {
+            valido = false;
+            break;
+        }
+        std::lock_guard<std::mutex> trava(ingestao.mutex);
+        ingestao.palavras += lote.size();
+        ingestao.lotes.push_back(std::move(lote));
+    }
+    c.recebido.erase(c.recebido.begin(), c.recebido.begin() + inicio);
+    return valido;
+}
+
+// Laco da thread de recepcao: aceita clientes e le os seus lotes
+void receberIngestao() {
+    std::vector<clienteIngestao> clientes;
+    std::vector<pollfd> fds;
+    uint8_t buffer[1 << 16];
+    while (true) {
+        bool cheia;
+        {
+            std::lock_guard<std::mutex> trava(ingestao.mutex);
+            if (ingestao.encerrar) break;
+            cheia = ingestao.palavras > LIMITE_FILA_INGESTAO;
+        }
+        fds.assign(1, {ingestao.servidor, POLLIN, 0});
+        // Com a fila cheia os clientes nao sao lidos, e o envio deles bloqueia
+        if (!cheia) {
+            for (const auto& c : clientes) fds.push_back({c.fd, POLLIN, 0});
+        }
+        // Espera limitada, para perceber o encerramento
+        if (poll(fds.data(), fds.size(), 100) <= 0) continue;
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(ingestao.servidor, nullptr, nullptr);
+            if (fd >= 0) clientes.push_back({fd, {}});
+        }
+        for (size_t i = 1; i < fds.size(); ++i) {
+            if (!fds[i].revents) continue;
+            clienteIngestao& c = clientes[i - 1];
+            ssize_t lidos = read(c.fd, buffer, sizeof(buffer));
+            if (lidos > 0) {
+                c.recebido.insert(c.recebido.end(), buffer, buffer + lidos);
+                if (extrairLotes(c)) continue;
+                fprintf(stderr, "Lote invalido recebido pelo socket; conexao encerrada\n");
+            } else if (lidos < 0 && errno == EINTR) {
+                continue;
+            }
+            close(c.fd);
+            c.fd = -1;
+        }
+        clientes.erase(std::remove_if(clientes.begin(), clientes.end(), [](const clienteIngestao& c) {
+            return c.fd < 0;
+        }), clientes.end());
+    }
+    for (const auto& c : clientes) close(c.fd);
+}
+
+void encerrarIngestao() {
+    if (!ingestao.thread.joinable()) return;
+    {
+        std::lock_guard<std::mutex> trava(ingestao.mutex);
+        ingestao.encerrar = true;
+    }
+    ingestao.thread.join();
+    close(ingestao.servidor);
+    unlink(socketIngestao);
+}
+
+bool iniciarIngestao() {
+    sockaddr_un endereco{};
+    if (strlen(socketIngestao) >= sizeof(endereco.sun_path)) return false;
+    endereco.sun_family = AF_UNIX;
+    strcpy(endereco.sun_path, socketIngestao);
+    ingestao.servidor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ingestao.servidor < 0) return false;
+    unlink(socketIngestao); // socket deixado por uma execucao anterior
+    if (bind(ingestao.servidor, reinterpret_cast<sockaddr*>(&endereco), sizeof(endereco)) != 0 ||
+        listen(ingestao.servidor, 8) != 0) {
+        close(ingestao.servidor);
+        return false;
+    }
+    fcntl(ingestao.servidor, F_SETFL, O_NONBLOCK);
+    ingestao.thread = std::thread(receberIngestao);
+    atexit(encerrarIngestao);
+    printf("Recebendo comandos em %s\n", socketIngestao);
+    return true;
+}
+
+// Função que indica se as formas do conjunto, levadas por matriz (em torno do pivo comum,
+// se pedido), continuam dentro dos limites de coordenada e, as preenchidas, de area.
+// Cada comando e validado sozinho, mas uma sequencia de escalas ou translacoes poderia
+// acumular ate estourar um int ou exigir um preenchimento gigantesco
+bool transformacaoCabe(const std::vector<forma*>& conjunto, const matriz3& matriz, bool emTornoDoPivo) {
+    vertice pivo = emTornoDoPivo ? calcularPivo(conjunto) : vertice{0, 0};
+    for (const forma* f : conjunto) {
+        if (f->xMin > f->xMax) continue;
+        double xMin = HUGE_VAL, yMin = HUGE_VAL, xMax = -HUGE_VAL, yMax = -HUGE_VAL;
+        for (int canto = 0; canto < 4; ++canto) {
+            double x = (canto & 1 ? f->xMax : f->xMin) - pivo.x, y = (canto & 2 ? f->yMax : f->yMin) - pivo.y;
+            double tx = x * matriz[0][0] + y * matriz[0][1] + matriz[0][2] + pivo.x;
+            double ty = x * matriz[1][0] + y * matriz[1][1] + matriz[1][2] + pivo.y;
+            xMin = std::min(xMin, tx);
+            yMin = std::min(yMin, ty);
+            xMax = std::max(xMax, tx);
+            yMax = std::max(yMax, ty);
+        }
+        if (std::max(-xMin, xMax) > LIMITE_COORDENADA || std::max(-yMin, yMax) > LIMITE_COORDENADA) return false;
+        bool preenchida = f->preenchido || (f->tipo == INST && f->def && f->def->preenchido);
+        if (preenchida && (xMax - xMin + 1) * (yMax - yMin + 1) > LIMITE_AREA_PREENCHIDA) return false;
+    }
+    return true;
+}
+
+// Função que indexa de uma vez as formas criadas ou preenchidas pelos comandos
+void indexarPendentes(std::vector<forma*>& pendentes) {
+    if (pendentes.empty()) return;
+    paraCadaForma(pendentes, [](forma&) {});
+    pendentes.clear();
+}
+
+// Função que calcula a area do retangulo envolvente de uma forma pelos seus vertices,
+// valida tambem para formas que ainda nao foram indexadas
+double areaDosVertices(const forma& f) {
+    if (f.tipo == CIR) {
+        double lado = 2.0 * f.v.front().x + 1;
+        return lado * lado;
+    }
+    int xMin = INT_MAX, yMin = INT_MAX, xMax = INT_MIN, yMax = INT_MIN;
+    for (const auto& vert : f.v) {
+        xMin = std::min(xMin, vert.x);
+        yMin = std::min(yMin, vert.y);
+        xMax = std::max(xMax, vert.x);
+        yMax = std::max(yMax, vert.y);
+    }
+    return (double(xMax) - xMin + 1) * (double(yMax) - yMin + 1);
+}
+
+// Função que aplica um comando validado
+// As formas criadas ou preenchidas entram em pendentes, para serem indexadas em lote;
+// antes de uma transformacao, que depende do retangulo envolvente, as pendentes sao indexadas
+void aplicarComando(const int32_t* c, std::vector<forma*>& pendentes) {
+    auto alvos = [&](int32_t k) {
+        std::vector<forma*> conjunto;
+        if (k == 0) {
+            conjunto = selecao;
+            if (conjunto.empty() && !formas.empty()) conjunto.push_back(&formas.front());
+        } else {
+            for (auto it = formas.begin(); it != formas.end() && static_cast<int32_t>(conjunto.size()) < k; ++it) {
+                conjunto.push_back(&*it);
+            }
+        }
+        return conjunto;
+    };
+    switch (c[0]) {
+        case LIN:
+            pushLinha(c[1], c[2], c[3], c[4], false);
+            pendentes.push_back(&formas.front());
+            break;
+        case TRI:
+            pushTri(c[1], c[2], c[3], c[4], c[5], c[6], false);
+            pendentes.push_back(&formas.front());
+            break;
+        case QUAD:
+            pushQuad(c[1], c[2], c[3], c[4], false);
+            pendentes.push_back(&formas.front());
+            break;
+        case CIR:
+            pushCirculo(c[1], c[2], c[3], false);
+            pendentes.push_back(&formas.front());
+            break;
+        case POL: {
+            pushForma(POL);
+            for (int32_t i = 0; i < c[1]; ++i) pushVertice(c[2 + 2 * i], c[3 + 2 * i]);
+            pendentes.push_back(&formas.front());
+            break;
+        }
+        case PREENCHER: {
+            for (forma* f : alvos(c[1])) {
+                if (f->preenchido || f->tipo == LIN || f->tipo == INST) continue;
+                if (areaDosVertices(*f) > LIMITE_AREA_PREENCHIDA) {
+                    fprintf(stderr, "Forma grande demais para preencher pelo socket; ignorada\n");
+                    continue;
+                }
+                for (int i = 0; i < 3; ++i) f->cor[i] = std::min(std::max(c[2 + i], 0), 255);
+                f->estilo = std::min(std::max(c[5], static_cast<int32_t>(SOLIDO)), static_cast<int32_t>(PADRAO));
+                if (f->tipo == CIR) preencherCirculo(*f);
+                else preencherPoligono(*f);
+                // Uma forma ainda sem pedacos foi criada neste passo e ja esta pendente
+                if (f->pedacos) pendentes.push_back(f);
+            }
+            break;
+        }
+        default: {
+            indexarPendentes(pendentes);
+            std::vector<forma*> conjunto = alvos(c[1]);
+            if (conjunto.empty()) break;
+            // Transformacoes que levariam as formas para fora do canvas sao ignoradas
+            matriz3 matriz;
+            switch (c[0]) {
+                case TRANSLADAR: matriz = criarMatrizTranslacao(palavraFloat(c[2]), palavraFloat(c[3])); break;
+                case ESCALAR: matriz = criarMatrizEscala(palavraFloat(c[2])); break;
+                case ROTACIONAR: matriz = criarMatrizRotacao(palavraFloat(c[2])); break;
+                case CISALHAR: matriz = {{{1, palavraFloat(c[2]), 0}, {palavraFloat(c[3]), 1, 0}, {0, 0, 1}}}; break;
+                case REFLETIR: matriz = {{{c[3] ? -1.0f : 1.0f, 0, 0}, {0, c[2] ? -1.0f : 1.0f, 0}, {0, 0, 1}}}; break;
+            }
+            if (!transformacaoCabe(conjunto, matriz, c[0] != TRANSLADAR)) {
+                fprintf(stderr, "Transformacao recebida pelo socket sairia do canvas; ignorada\n");
+                break;
+            }
+            switch (c[0]) {
+                case TRANSLADAR: transladarForma(conjunto, palavraFloat(c[2]), palavraFloat(c[3])); break;
+                case ESCALAR: escalarForma(conjunto, palavraFloat(c[2])); break;
+                case ROTACIONAR: rotacionarForma(conjunto, palavraFloat(c[2])); break;
+                case CISALHAR: cisalharForma(conjunto, palavraFloat(c[2]), palavraFloat(c[3])); break;
+                case REFLETIR: refletirForma(conjunto, c[2] != 0, c[3] != 0); break;
+            }
+            break;
+        }
+    }
+}
+
+// Função que aplica os comandos enfileirados ate esgotar o orcamento; devolve quantos aplicou
+size_t aplicarIngestao() {
+    if (ingestao.lote >= ingestao.aplicando.size()) {
+        ingestao.aplicando.clear();
+        ingestao.lote = ingestao.posicao = 0;
+        std::lock_guard<std::mutex> trava(ingestao.mutex);
+        ingestao.aplicando.swap(ingestao.lotes);
+    }
+    auto inicio = std::chrono::steady_clock::now();
+    size_t aplicados = 0, liberadas = 0;
+    std::vector<forma*> pendentes;
+    while (ingestao.lote < ingestao.aplicando.size()) {
+        const std::vector<int32_t>& lote = ingestao.aplicando[ingestao.lote];
+        if (ingestao.posicao >= lote.size()) {
+            liberadas += lote.size();
+            ++ingestao.lote;
+            ingestao.posicao = 0;
+            continue;
+        }
+        const int32_t* c = &lote[ingestao.posicao];
+        ingestao.posicao += tamanhoComando(c, lote.size() - ingestao.posicao);
+        aplicarComando(c, pendentes);
+        // Lotes limitados mantem as formas recentes no cache e a indexacao dentro do orcamento
+        if (pendentes.size() >= LOTE_INDEXACAO) indexarPendentes(pendentes);
+        ++aplicados;
+        // O relogio e consultado a cada 64 comandos
+        if ((aplicados & 63) == 0 &&
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count() > ORCAMENTO_INGESTAO) {
+            break;
+        }
+    }
+    // As formas criadas e preenchidas neste passo entram nos ladrilhos de uma vez
+    indexarPendentes(pendentes);
+    if (liberadas) {
+        std::lock_guard<std::mutex> trava(ingestao.mutex);
+        ingestao.palavras -= liberadas;
+    }
+    return aplicados;
+}
+
+// Passo periodico, chamado por temporizador na thread da interface
+void ingestaoPasso(int valor) {
+    if (aplicarIngestao() > 0) pedirRedesenho();
+    glutTimerFunc(INTERVALO_INGESTAO, ingestaoPasso, valor);
+}
+#else
+bool iniciarIngestao() {
+    fprintf(stderr, "--socket so esta disponivel em sistemas POSIX\n");
+    return false;
+}
+
+void ingestaoPasso(int valor) {}
+#endif